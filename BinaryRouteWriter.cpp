@@ -0,0 +1,264 @@
+#include "BinaryRouteWriter.h"
+#include <string>
+#include <cstring>
+#include <cmath>
+using namespace std;
+
+const char VERSION = 2;
+const double MILE_UNITS = 100000;       //distances are in 1/100000 mile
+const double DEGREE_UNITS = 10000000;   //and points in 1/10000000 degree
+const char* const DIRECTIONS[] = { "east", "northeast", "north", "northwest",
+    "west", "southwest", "south", "southeast", "left", "right" };
+const size_t NUM_DIRECTIONS = sizeof(DIRECTIONS) / sizeof(DIRECTIONS[0]);
+
+BinaryRouteWriter::BinaryRouteWriter(string& out)
+    :m_out(out), m_pendingStart(false), m_anyPoints(false), m_lastLat(0), m_lastLon(0)
+{
+    m_out += "GEPL";
+    m_out += VERSION;
+}
+
+void BinaryRouteWriter::accept(const DeliveryStep& step)
+{
+    switch (step.type)
+    {
+    case DeliveryStep::PROCEED:
+    {
+        unsigned int id = nameId(*step.streetName);
+        m_out += char(TAG_PROCEED);
+        m_out += char(directionCode(step.direction));
+        putVarint(id);
+        putVarint(llround(step.distance * MILE_UNITS));
+        putVarint(2 * m_pendingPoints.size() + (m_pendingStart ? 1 : 0));
+        for (size_t k = 0; k < m_pendingPoints.size(); k++)
+        {
+            putSigned(m_pendingPoints[k].first - m_lastLat);
+            putSigned(m_pendingPoints[k].second - m_lastLon);
+            m_lastLat = m_pendingPoints[k].first;
+            m_lastLon = m_pendingPoints[k].second;
+            m_anyPoints = true;
+        }
+        m_pendingPoints.clear();
+        m_pendingStart = false;
+        break;
+    }
+    case DeliveryStep::TURN:
+    {
+        unsigned int id = nameId(*step.streetName);
+        m_out += char(TAG_TURN);
+        m_out += char(directionCode(step.direction));
+        putVarint(id);
+        break;
+    }
+    case DeliveryStep::DELIVER:
+        m_out += char(TAG_DELIVER);
+        putString(*step.item);
+        break;
+    }
+}
+
+void BinaryRouteWriter::acceptSegment(const StreetSegment& segment)
+{
+    //the first segment of a street contributes its start too, unless the
+    //last street ended there
+    if (m_pendingPoints.empty() && !m_pendingStart)
+    {
+        long long lat = llround(segment.start.latitude * DEGREE_UNITS);
+        long long lon = llround(segment.start.longitude * DEGREE_UNITS);
+        if (!m_anyPoints || lat != m_lastLat || lon != m_lastLon)
+        {
+            m_pendingPoints.push_back(make_pair(lat, lon));
+            m_pendingStart = true;
+        }
+    }
+    putPoint(segment.end);
+}
+
+void BinaryRouteWriter::finish(DeliveryResult result, double totalDistance)
+{
+    m_out += char(TAG_END);
+    m_out += char(result);
+    putVarint(llround(totalDistance * MILE_UNITS));
+}
+
+void BinaryRouteWriter::putVarint(unsigned long long value)
+{
+    //7 bits at a time, low bits first, high bit set on all but the last byte
+    while (value >= 0x80)
+    {
+        m_out += char((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    m_out += char(value);
+}
+
+void BinaryRouteWriter::putSigned(long long value)
+{
+    //zigzag, so that small negative deltas stay short too
+    putVarint((static_cast<unsigned long long>(value) << 1) ^ static_cast<unsigned long long>(value >> 63));
+}
+
+void BinaryRouteWriter::putString(const string& str)
+{
+    putVarint(str.size());
+    m_out += str;
+}
+
+void BinaryRouteWriter::putPoint(const GeoCoord& gc)
+{
+    m_pendingPoints.push_back(make_pair(llround(gc.latitude * DEGREE_UNITS), llround(gc.longitude * DEGREE_UNITS)));
+}
+
+unsigned int BinaryRouteWriter::nameId(const string& name)
+{
+    const unsigned int* ptrToId = m_nameIds.find(name);
+    if (ptrToId != nullptr)
+        return *ptrToId;
+    unsigned int id = m_nameIds.size();
+    m_nameIds.associate(name, id);
+    m_out += char(TAG_NAME);
+    putString(name);
+    return id;
+}
+
+unsigned char BinaryRouteWriter::directionCode(const char* direction) const
+{
+    for (unsigned char k = 0; k < NUM_DIRECTIONS; k++)
+    {
+        if (strcmp(direction, DIRECTIONS[k]) == 0)
+            return k;
+    }
+    return 0;
+}
+
+//******************** reading ************************************************
+
+bool getVarint(const string& data, size_t& pos, unsigned long long& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < data.size(); shift += 7)
+    {
+        unsigned char byte = data[pos++];
+        value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool getSigned(const string& data, size_t& pos, long long& value)
+{
+    unsigned long long zigzag;
+    if (!getVarint(data, pos, zigzag))
+        return false;
+    value = static_cast<long long>(zigzag >> 1) ^ -static_cast<long long>(zigzag & 1);
+    return true;
+}
+
+bool getString(const string& data, size_t& pos, string& str)
+{
+    unsigned long long len;
+    if (!getVarint(data, pos, len) || len > data.size() - pos)
+        return false;
+    str = data.substr(pos, len);
+    pos += len;
+    return true;
+}
+
+bool getDirection(const string& data, size_t& pos, string& direction)
+{
+    if (pos >= data.size() || static_cast<unsigned char>(data[pos]) >= NUM_DIRECTIONS)
+        return false;
+    direction = DIRECTIONS[static_cast<unsigned char>(data[pos++])];
+    return true;
+}
+
+bool getName(const string& data, size_t& pos, const vector<string>& names, string& name)
+{
+    unsigned long long id;
+    if (!getVarint(data, pos, id) || id >= names.size())
+        return false;
+    name = names[id];
+    return true;
+}
+
+bool readBinaryRoute(const string& data, vector<BinaryRouteRecord>& records)
+{
+    records.clear();
+    if (data.size() < 5 || data.compare(0, 4, "GEPL") != 0 || data[4] != VERSION)
+        return false;
+    size_t pos = 5;
+    vector<string> names;
+    bool anyPoints = false;
+    long long lat = 0;
+    long long lon = 0;
+    while (pos < data.size())
+    {
+        BinaryRouteRecord rec;
+        unsigned long long value;
+        switch (data[pos++])
+        {
+        case BinaryRouteWriter::TAG_NAME:
+        {
+            string name;
+            if (!getString(data, pos, name))
+                return false;
+            names.push_back(name);
+            continue;
+        }
+        case BinaryRouteWriter::TAG_PROCEED:
+        {
+            rec.type = BinaryRouteRecord::PROCEED;
+            if (!getDirection(data, pos, rec.direction) || !getName(data, pos, names, rec.streetName) ||
+                !getVarint(data, pos, value))
+                return false;
+            rec.distance = value / MILE_UNITS;
+            unsigned long long count;
+            if (!getVarint(data, pos, count))
+                return false;
+            //a street that follows on from the last one starts where it ended
+            if ((count & 1) == 0)
+            {
+                if (!anyPoints)
+                    return false;
+                rec.points.push_back(make_pair(lat / DEGREE_UNITS, lon / DEGREE_UNITS));
+            }
+            for (count /= 2; count > 0; count--)
+            {
+                long long dLat, dLon;
+                if (!getSigned(data, pos, dLat) || !getSigned(data, pos, dLon))
+                    return false;
+                lat += dLat;
+                lon += dLon;
+                anyPoints = true;
+                rec.points.push_back(make_pair(lat / DEGREE_UNITS, lon / DEGREE_UNITS));
+            }
+            break;
+        }
+        case BinaryRouteWriter::TAG_TURN:
+            rec.type = BinaryRouteRecord::TURN;
+            if (!getDirection(data, pos, rec.direction) || !getName(data, pos, names, rec.streetName))
+                return false;
+            break;
+        case BinaryRouteWriter::TAG_DELIVER:
+            rec.type = BinaryRouteRecord::DELIVER;
+            if (!getString(data, pos, rec.item))
+                return false;
+            break;
+        case BinaryRouteWriter::TAG_END:
+            rec.type = BinaryRouteRecord::END;
+            if (pos >= data.size())
+                return false;
+            rec.result = static_cast<DeliveryResult>(data[pos++]);
+            if (!getVarint(data, pos, value))
+                return false;
+            rec.distance = value / MILE_UNITS;
+            records.push_back(rec);
+            return pos == data.size();
+        default:
+            return false;
+        }
+        records.push_back(rec);
+    }
+    return false;
+}
@@ -0,0 +1,84 @@
+// BinaryRouteWriter.h
+
+#ifndef BINARYROUTEWRITER_H
+#define BINARYROUTEWRITER_H
+
+#include "provided.h"
+#include "ExpandableHashMap.h"
+#include <string>
+#include <vector>
+
+// Serializes a plan's commands together with its route geometry into a
+// compact record stream, appended to one caller-owned buffer.
+//
+// The stream starts with the magic "GEPL" and a version byte (2), followed by
+// records that each begin with a tag byte:
+//   NAME    (1): varint length, bytes. Defines the next street-name id,
+//                counting from 0, before its first use.
+//   PROCEED (2): direction byte, varint name id, varint distance in
+//                1/100000 mile, varint twice the point count, plus 1 if the
+//                first point is where the street starts, then the points as
+//                zigzag varint deltas of latitude then longitude in
+//                1/10000000 degree. A street that starts where the previous
+//                PROCEED ended, as every one after the first in a route
+//                does, starts from that point without repeating it. Deltas
+//                run on from the last point written, starting at 0,0.
+//   TURN    (3): direction byte, varint name id.
+//   DELIVER (4): varint length, item bytes.
+//   END     (0): status byte (a DeliveryResult), varint total distance in
+//                1/100000 mile.
+// Directions are numbered east, northeast, north, northwest, west,
+// southwest, south, southeast, left, right.
+class BinaryRouteWriter : public DeliveryCommandSink
+{
+public:
+    BinaryRouteWriter(std::string& out);
+    void accept(const DeliveryStep& step);
+    void acceptSegment(const StreetSegment& segment);
+    // write the END record once the planner has returned
+    void finish(DeliveryResult result, double totalDistance);
+
+    BinaryRouteWriter(const BinaryRouteWriter&) = delete;
+    BinaryRouteWriter& operator=(const BinaryRouteWriter&) = delete;
+
+    // the tag byte that begins each record
+    enum RecordTag { TAG_END, TAG_NAME, TAG_PROCEED, TAG_TURN, TAG_DELIVER };
+
+private:
+    std::string& m_out;
+    ExpandableHashMap<std::string, unsigned int> m_nameIds;
+    std::vector<std::pair<long long, long long>> m_pendingPoints;   //of the street we're on
+    bool m_pendingStart;    //the first pending point is where the street starts
+    bool m_anyPoints;       //m_lastLat and m_lastLon have been written
+    long long m_lastLat;
+    long long m_lastLon;
+
+    void putVarint(unsigned long long value);
+    void putSigned(long long value);
+    void putString(const std::string& str);
+    void putPoint(const GeoCoord& gc);
+    unsigned int nameId(const std::string& name);
+    unsigned char directionCode(const char* direction) const;
+};
+
+// One record of a stream that BinaryRouteWriter wrote, as readBinaryRoute
+// decodes it: names looked up, distances in miles and points in degrees.
+struct BinaryRouteRecord
+{
+    enum RecordType { PROCEED, TURN, DELIVER, END };
+    RecordType type = END;
+    std::string direction;      // PROCEED and TURN
+    std::string streetName;     // PROCEED and TURN
+    std::string item;           // DELIVER
+    double distance = 0;        // PROCEED, and the plan's total for END
+    DeliveryResult result = DELIVERY_SUCCESS;   // END
+    // PROCEED: the latitude and longitude of each point along the street,
+    // from where it starts, whether or not the stream repeated that point
+    std::vector<std::pair<double, double>> points;
+};
+
+// Decode a whole stream, ending with its END record. False if the stream is
+// cut short, or isn't one BinaryRouteWriter could have written.
+bool readBinaryRoute(const std::string& data, std::vector<BinaryRouteRecord>& records);
+
+#endif // !BINARYROUTEWRITER_H
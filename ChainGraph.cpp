@@ -0,0 +1,290 @@
+#include "ChainGraph.h"
+#include <queue>
+#include <limits>
+#include <utility>
+#include <algorithm>
+using namespace std;
+
+const size_t NO_NODE = static_cast<size_t>(-1);
+const size_t NO_EDGE = static_cast<size_t>(-1);
+
+ChainGraph::ChainGraph(const StreetMap& sm)
+    : m_map(sm)
+{
+    //a point is a node unless it only joins two different neighbours
+    size_t numPoints = sm.getNumPoints();
+    ChainPos unreached = { NO_EDGE, NO_EDGE, 0, 0 };
+    m_nodeOf.assign(numPoints, NO_NODE);
+    m_chainPos.assign(numPoints, unreached);
+    for (size_t p = 0; p < numPoints; p++)
+    {
+        if (!isShapePoint(p))
+            addNode(p);
+    }
+
+    //the edges out of every node, in node order; a loop made only of shape
+    //points has none of them, so one of its points is made a node once the
+    //rest are done
+    size_t nextUnreached = 0;
+    for (size_t n = 0; ; n++)
+    {
+        if (n == m_pointOf.size())
+        {
+            while (nextUnreached < numPoints &&
+                (m_nodeOf[nextUnreached] != NO_NODE || m_chainPos[nextUnreached].forwardEdge != NO_EDGE))
+                nextUnreached++;
+            if (nextUnreached == numPoints)
+                break;
+            addNode(nextUnreached);
+        }
+        m_firstEdge.push_back(m_edges.size());
+        addEdges(n);
+    }
+    m_firstEdge.push_back(m_edges.size());
+}
+
+bool ChainGraph::isShapePoint(size_t point) const
+{
+    size_t first, count;
+    m_map.getSegmentIds(point, first, count);
+    if (count != 2)
+        return false;
+    const StreetSegment& a = m_map.getSegment(first);
+    const StreetSegment& b = m_map.getSegment(first + 1);
+    return a.end != b.end && a.end != a.start && b.end != b.start;
+}
+
+void ChainGraph::addNode(size_t point)
+{
+    size_t first, count;
+    m_map.getSegmentIds(point, first, count);
+    m_nodeOf[point] = m_pointOf.size();
+    m_pointOf.push_back(point);
+    m_coordOf.push_back(&m_map.getSegment(first).start);
+}
+
+void ChainGraph::addEdges(size_t node)
+{
+    size_t first, count;
+    m_map.getSegmentIds(m_pointOf[node], first, count);
+    for (size_t i = first; i < first + count; i++)
+    {
+        //follow the street through its shape points to the next node
+        Edge e;
+        e.cost = 0;
+        e.firstSeg = m_segs.size();
+        size_t edgeIndex = m_edges.size();
+        size_t segId = i;
+        for (;;)
+        {
+            const StreetSegment& seg = m_map.getSegment(segId);
+            m_segs.push_back(segId);
+            e.cost += distanceEarthMiles(seg.start, seg.end);
+            size_t point = 0;
+            m_map.getPointId(seg.end, point);   //every segment's end starts one too
+            if (m_nodeOf[point] != NO_NODE)
+            {
+                e.to = m_nodeOf[point];
+                break;
+            }
+
+            //every run is followed once from each end, the second time in reverse
+            ChainPos& pos = m_chainPos[point];
+            if (pos.forwardEdge == NO_EDGE)
+            {
+                ChainPos newPos = { edgeIndex, edgeIndex, m_segs.size() - 1 - e.firstSeg, e.cost };
+                pos = newPos;
+            }
+            else
+                pos.reverseEdge = edgeIndex;
+
+            size_t next, numNext;
+            m_map.getSegmentIds(point, next, numNext);
+            segId = (m_map.getSegment(next).end == seg.start ? next + 1 : next);
+        }
+        e.numSegs = m_segs.size() - e.firstSeg;
+        m_edges.push_back(e);
+    }
+}
+
+// What a search knows of each node: its cost so far, whether it has been
+// expanded, and how it was reached. Each thread keeps one, as big as the
+// largest graph it has searched, and each search first resets just the
+// nodes the one before it touched, so a short search costs no more than
+// what it touches, however big the map.
+struct ChainGraph::SearchState
+{
+    vector<double> cost;
+    vector<char> expanded;      //not vector<bool>, for speed
+    vector<Leg> cameFrom;       //the node before, and the segments from it
+    vector<size_t> touched;
+
+    void reset(size_t numNodes)
+    {
+        for (size_t k = 0; k < touched.size(); k++)
+        {
+            cost[touched[k]] = numeric_limits<double>::infinity();
+            expanded[touched[k]] = false;
+        }
+        touched.clear();
+        if (cost.size() < numNodes)
+        {
+            cost.resize(numNodes, numeric_limits<double>::infinity());
+            expanded.resize(numNodes, false);
+            cameFrom.resize(numNodes);
+        }
+    }
+};
+
+void ChainGraph::legsFrom(const ChainPos& pos, Leg legs[2]) const
+{
+    const Edge& forward = m_edges[pos.forwardEdge];
+    const Edge& reverse = m_edges[pos.reverseEdge];
+    size_t n = forward.numSegs;
+    //on along the edge
+    legs[0].node = forward.to;
+    legs[0].cost = forward.cost - pos.fromStart;
+    legs[0].firstSeg = forward.firstSeg + pos.k + 1;
+    legs[0].numSegs = n - 1 - pos.k;
+    //back to where it starts, along the tail of the reverse edge
+    legs[1].node = reverse.to;
+    legs[1].cost = pos.fromStart;
+    legs[1].firstSeg = reverse.firstSeg + n - 1 - pos.k;
+    legs[1].numSegs = pos.k + 1;
+}
+
+void ChainGraph::legsTo(const ChainPos& pos, Leg legs[2]) const
+{
+    const Edge& forward = m_edges[pos.forwardEdge];
+    const Edge& reverse = m_edges[pos.reverseEdge];
+    size_t n = forward.numSegs;
+    //in from where the edge starts
+    legs[0].node = reverse.to;
+    legs[0].cost = pos.fromStart;
+    legs[0].firstSeg = forward.firstSeg;
+    legs[0].numSegs = pos.k + 1;
+    //in from where it ends, along the head of the reverse edge
+    legs[1].node = forward.to;
+    legs[1].cost = forward.cost - pos.fromStart;
+    legs[1].firstSeg = reverse.firstSeg;
+    legs[1].numSegs = n - 1 - pos.k;
+}
+
+DeliveryResult ChainGraph::route(const GeoCoord& start, const GeoCoord& end, list<StreetSegment>& route,
+    double& totalDistanceTravelled, const CancellationToken* cancel, bool& interrupted,
+    RouteQueryStats& q) const
+{
+    interrupted = false;
+    //each end is either a node, or part way along an edge
+    size_t startPoint, endPoint;
+    if (!m_map.getPointId(start, startPoint) || !m_map.getPointId(end, endPoint))
+        return BAD_COORD;
+    const size_t* startNode = (m_nodeOf[startPoint] != NO_NODE ? &m_nodeOf[startPoint] : nullptr);
+    const ChainPos* startPos = (startNode == nullptr ? &m_chainPos[startPoint] : nullptr);
+    const size_t* endNode = (m_nodeOf[endPoint] != NO_NODE ? &m_nodeOf[endPoint] : nullptr);
+    const ChainPos* endPos = (endNode == nullptr ? &m_chainPos[endPoint] : nullptr);
+
+    //an end part way along an edge is reached through one more node, past
+    //all the real ones
+    size_t numNodes = m_pointOf.size();
+    size_t goal = (endNode != nullptr ? *endNode : numNodes);
+    thread_local SearchState state;
+    state.reset(numNodes + 1);
+    vector<double>& cost = state.cost;
+    vector<char>& expanded = state.expanded;
+    vector<Leg>& cameFrom = state.cameFrom;
+
+    //Using the A* searching algorithm, as PointToPointRouter does
+    priority_queue<pair<double, size_t>, vector<pair<double, size_t>>,
+        greater<pair<double, size_t>>> nodesToExamine;
+    auto relax = [&](size_t node, double newCost, size_t from, size_t firstSeg, size_t numSegs)
+    {
+        if (newCost >= cost[node])
+            return;
+        if (cost[node] == numeric_limits<double>::infinity())
+            state.touched.push_back(node);
+        cost[node] = newCost;
+        Leg leg = { from, newCost, firstSeg, numSegs };
+        cameFrom[node] = leg;
+        double estimate = (node == numNodes ? 0 : distanceEarthMiles(*m_coordOf[node], end));
+        nodesToExamine.push(make_pair(newCost + estimate, node));
+        q.heapPushes++;
+        q.maxFrontier = max(q.maxFrontier, nodesToExamine.size());
+    };
+
+    Leg legs[2];
+    if (startNode != nullptr)
+        relax(*startNode, 0, NO_NODE, 0, 0);
+    else
+    {
+        legsFrom(*startPos, legs);
+        for (int i = 0; i < 2; i++)
+            relax(legs[i].node, legs[i].cost, NO_NODE, legs[i].firstSeg, legs[i].numSegs);
+    }
+    Leg endLegs[2];
+    if (endPos != nullptr)
+    {
+        legsTo(*endPos, endLegs);
+        //both ends on the same edge: straight along it is a way too
+        if (startPos != nullptr && startPos->forwardEdge == endPos->forwardEdge)
+        {
+            if (endPos->k > startPos->k)
+                relax(goal, endPos->fromStart - startPos->fromStart, NO_NODE,
+                    m_edges[startPos->forwardEdge].firstSeg + startPos->k + 1, endPos->k - startPos->k);
+            else
+                relax(goal, startPos->fromStart - endPos->fromStart, NO_NODE,
+                    m_edges[startPos->reverseEdge].firstSeg + m_edges[startPos->forwardEdge].numSegs - 1 - startPos->k,
+                    startPos->k - endPos->k);
+        }
+    }
+
+    while (!nodesToExamine.empty())
+    {
+        size_t curr = nodesToExamine.top().second;
+        nodesToExamine.pop();
+        q.heapPops++;
+        if (expanded[curr])
+            continue;   //a stale entry
+        expanded[curr] = true;
+
+        if (curr == goal)
+        {
+            //collect the runs of segments from the goal back to the start
+            list<StreetSegment> output;
+            for (size_t node = goal; ; node = cameFrom[node].node)
+            {
+                const Leg& leg = cameFrom[node];
+                list<StreetSegment>::iterator legStart = output.begin();
+                for (size_t k = leg.firstSeg; k < leg.firstSeg + leg.numSegs; k++)
+                    output.insert(legStart, m_map.getSegment(m_segs[k]));
+                if (leg.node == NO_NODE)
+                    break;
+            }
+            swap(route, output);
+            totalDistanceTravelled = cost[goal];
+            return DELIVERY_SUCCESS;
+        }
+
+        //reading the clock on every expansion would cost more than the search
+        if (cancel != nullptr && (q.nodesExpanded & 255) == 0 && cancel->isCancelled())
+        {
+            interrupted = true;
+            break;
+        }
+        q.nodesExpanded++;
+        for (size_t e = m_firstEdge[curr]; e < m_firstEdge[curr + 1]; e++)
+        {
+            const Edge& edge = m_edges[e];
+            relax(edge.to, cost[curr] + edge.cost, curr, edge.firstSeg, edge.numSegs);
+        }
+        if (endPos != nullptr)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                if (endLegs[i].node == curr)
+                    relax(goal, cost[curr] + endLegs[i].cost, curr, endLegs[i].firstSeg, endLegs[i].numSegs);
+            }
+        }
+    }
+    return NO_ROUTE;
+}
@@ -0,0 +1,87 @@
+// ChainGraph.h
+
+#ifndef CHAINGRAPH_H
+#define CHAINGRAPH_H
+
+#include "provided.h"
+#include "PlanStats.h"
+#include <list>
+#include <vector>
+
+// A routing graph over a StreetMap's real intersections only. Most points in
+// a map are shape points along a street, with exactly two neighbours; each
+// run of them between two intersections becomes a single edge that keeps
+// its original segments, so a search only ever pushes, pops and scores
+// intersections, by index rather than by GeoCoord. Routes that start or end
+// part way along such a run are joined to the intersections at its ends.
+// The graph keeps the map's own point and segment numbers rather than
+// copies of them, and looks points up in the map's index.
+class ChainGraph
+{
+public:
+    // Reads the whole of sm, so sm should be fully loaded, and not tiled,
+    // and stay loaded for as long as the graph is used.
+    ChainGraph(const StreetMap& sm);
+    size_t numPoints() const { return m_nodeOf.size(); }
+    size_t numNodes() const { return m_pointOf.size(); }
+    size_t numEdges() const { return m_edges.size(); }
+    // Same contract as PointToPointRouter::generatePointToPointRoute, with a
+    // nullptr cancel for a search that runs to the end.
+    DeliveryResult route(const GeoCoord& start, const GeoCoord& end, std::list<StreetSegment>& route,
+        double& totalDistanceTravelled, const CancellationToken* cancel, bool& interrupted,
+        RouteQueryStats& q) const;
+
+    // C++11 syntax for preventing copying and assignment
+    ChainGraph(const ChainGraph&) = delete;
+    ChainGraph& operator=(const ChainGraph&) = delete;
+
+private:
+    struct Edge
+    {
+        size_t to;
+        double cost;
+        size_t firstSeg;    //into m_segs
+        size_t numSegs;
+    };
+
+    // Where a shape point sits: it is the end of segment k of forwardEdge,
+    // and reverseEdge runs the same way back. A node's forwardEdge is
+    // NO_EDGE.
+    struct ChainPos
+    {
+        size_t forwardEdge;
+        size_t reverseEdge;
+        size_t k;
+        double fromStart;   //along forwardEdge
+    };
+
+    // The part of an edge between a shape point and a node at one end.
+    struct Leg
+    {
+        size_t node;
+        double cost;
+        size_t firstSeg;    //into m_segs
+        size_t numSegs;
+    };
+
+    struct SearchState;
+
+    const StreetMap& m_map;
+    std::vector<size_t> m_pointOf;          //of each node, as the map numbers it
+    std::vector<const GeoCoord*> m_coordOf; //of each node, where the map keeps it
+    std::vector<size_t> m_nodeOf;           //of each map point, or NO_NODE for a shape point
+    std::vector<ChainPos> m_chainPos;       //of each map point
+    std::vector<size_t> m_firstEdge;        //each node's edges, as in a CSR graph
+    std::vector<Edge> m_edges;
+    std::vector<size_t> m_segs;             //the map's numbers for each edge's segments, in order
+
+    bool isShapePoint(size_t point) const;
+    void addNode(size_t point);
+    void addEdges(size_t node);
+    // the ways from a shape point out to the nodes at either end of its
+    // edge, and in from them
+    void legsFrom(const ChainPos& pos, Leg legs[2]) const;
+    void legsTo(const ChainPos& pos, Leg legs[2]) const;
+};
+
+#endif // !CHAINGRAPH_H
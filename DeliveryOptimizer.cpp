@@ -11,7 +11,8 @@ public:
         const GeoCoord& depot,
         vector<DeliveryRequest>& deliveries,
         double& oldCrowDistance,
-        double& newCrowDistance) const;
+        double& newCrowDistance,
+        const CancellationToken* cancel) const;
 private:
     const StreetMap* m_streetMap;
 };
@@ -29,7 +30,8 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
     const GeoCoord& depot,
     vector<DeliveryRequest>& deliveries,
     double& oldCrowDistance,
-    double& newCrowDistance) const
+    double& newCrowDistance,
+    const CancellationToken* cancel) const
 {
     oldCrowDistance = 0;
     newCrowDistance = 0;
@@ -62,6 +64,9 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
 
     for (size_t i = 0; i < deliveries.size() - 1; i++)
     {
+        //the stops after i keep whatever order they're in
+        if (cancel != nullptr && cancel->isCancelled())
+            break;
         int minIndex = i + 1;
         double minDist = distanceEarthMiles(deliveries[i].location, deliveries[minIndex].location);
         for (size_t j = i + 2; j < deliveries.size(); j++)
@@ -107,5 +112,15 @@ void DeliveryOptimizer::optimizeDeliveryOrder(
     double& oldCrowDistance,
     double& newCrowDistance) const
 {
-    return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
+    return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance, nullptr);
+}
+
+void DeliveryOptimizer::optimizeDeliveryOrder(
+    const GeoCoord& depot,
+    vector<DeliveryRequest>& deliveries,
+    double& oldCrowDistance,
+    double& newCrowDistance,
+    const CancellationToken& cancel) const
+{
+    return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance, &cancel);
 }
@@ -1,143 +1,734 @@
 #include "provided.h"
+#include "ExpandableHashMap.h"
+#include "ThreadPool.h"
+#include "PlanStats.h"
 #include <vector>
+#include <future>
+#include <atomic>
+#include <algorithm>
 using namespace std;
 
 class DeliveryPlannerImpl
 {
 public:
-    DeliveryPlannerImpl(const StreetMap* sm);
-    ~DeliveryPlannerImpl();
+    DeliveryPlannerImpl(const StreetMap* sm, ThreadPool* pool);
     DeliveryResult generateDeliveryPlan(
         const GeoCoord& depot,
         const vector<DeliveryRequest>& deliveries,
         vector<DeliveryCommand>& commands,
         double& totalDistanceTravelled) const;
+    DeliveryResult generateDeliveryPlan(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        DeliveryPlan& plan) const;
+    DeliveryResult insertDeliveries(
+        DeliveryPlan& plan,
+        const vector<DeliveryRequest>& lateDeliveries,
+        vector<DeliveryCommand>& commands,
+        double& totalDistanceTravelled) const;
+    DeliveryResult generateDeliveryPlan(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        DeliveryCommandSink& sink,
+        double& totalDistanceTravelled) const;
+    DeliveryResult generateDeliveryPlans(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        int numDrivers,
+        vector<vector<DeliveryCommand>>& commands,
+        vector<double>& totalDistances,
+        int maxStopsPerDriver) const;
+    DeliveryResult findUnreachable(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        vector<DeliveryRequest>& unreachable) const;
+    future<AsyncPlanResult> generateDeliveryPlanAsync(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        CancellationToken cancel) const;
+    void setStats(PlanStats* stats);
+    void warmUp() const;
 private:
     const StreetMap* m_streetMap;
     PointToPointRouter m_router;
     DeliveryOptimizer m_optimizer;
+    ThreadPool* m_pool;     //nullptr to use the default pool
+    PlanStats* m_stats;
 
+    DeliveryResult buildPlan(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+        const CancellationToken* cancel, DeliveryPlan& plan, bool& complete,
+        vector<DeliveryRequest>& unserved) const;
+    DeliveryResult routeLegs(const GeoCoord& depot, const vector<DeliveryRequest>& stops,
+        const vector<bool>& needsRoute, vector<vector<DeliveryCommand>>& legCommands,
+        vector<double>& legDistances, const CancellationToken* cancel, size_t& firstInterruptedLeg) const;
     DeliveryResult createCommands(const GeoCoord& start, const GeoCoord& dest,
-        vector<DeliveryCommand>& commands, double& totalDist, string item) const;
+        vector<DeliveryCommand>& commands, double& totalDist, string item,
+        const CancellationToken* cancel, bool& interrupted) const;
+    void emitLeg(const list<StreetSegment>& route, const string& item, DeliveryCommandSink& sink) const;
+    void orderStops(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+        vector<DeliveryRequest>& stops, const CancellationToken* cancel) const;
 
-    string getDirection(const StreetSegment& street) const;
+    const char* getDirection(const StreetSegment& street) const;
+    Histogram* stat(Histogram PlanStats::* which) const;
+    ThreadPool* pool() const;
+    void partitionBySweep(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+        int numDrivers, size_t maxStopsPerDriver, vector<vector<DeliveryRequest>>& clusters) const;
+    bool dealRuns(const vector<DeliveryRequest>& deliveries, const vector<vector<size_t>>& runs,
+        size_t maxStopsPerDriver, vector<vector<DeliveryRequest>>& clusters) const;
 };
 
-DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm)
-    :m_streetMap(sm), m_router(sm), m_optimizer(sm)
+DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm, ThreadPool* pool)
+    :m_streetMap(sm), m_router(sm), m_optimizer(sm), m_pool(pool), m_stats(nullptr)
+{}
+
+DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<DeliveryCommand>& commands,
+    double& totalDistanceTravelled) const
+{
+    //if there is no deliveries
+    if (deliveries.size() == 0)
+        return DELIVERY_SUCCESS;
+
+    DeliveryPlan plan;
+    DeliveryResult res = generateDeliveryPlan(depot, deliveries, plan);
+    if (res != DELIVERY_SUCCESS)
+        return res;
+    plan.getCommands(commands);
+    totalDistanceTravelled = plan.totalDistance;
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryPlan& plan) const
+{
+    bool complete;
+    vector<DeliveryRequest> unserved;
+    return buildPlan(depot, deliveries, nullptr, plan, complete, unserved);
+}
+
+future<AsyncPlanResult> DeliveryPlannerImpl::generateDeliveryPlanAsync(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    CancellationToken cancel) const
 {
+    //take copies, the caller's may be gone by the time a thread is free
+    return pool()->submit([this, depot, deliveries, cancel]()
+    {
+        AsyncPlanResult res;
+        res.result = buildPlan(depot, deliveries, &cancel, res.plan, res.complete, res.unserved);
+        return res;
+    });
 }
 
-DeliveryPlannerImpl::~DeliveryPlannerImpl()
+DeliveryResult DeliveryPlannerImpl::buildPlan(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+    const CancellationToken* cancel, DeliveryPlan& plan, bool& complete,
+    vector<DeliveryRequest>& unserved) const
 {
+    ScopedTimer planTimer(stat(&PlanStats::planMicros));
+    DeliveryPlan output;
+    output.depot = depot;
+    complete = true;
+    unserved.clear();
+
+    //if there is no deliveries, the plan has no legs at all
+    if (deliveries.size() == 0)
+    {
+        swap(plan, output);
+        return DELIVERY_SUCCESS;
+    }
+
+    vector<DeliveryRequest> unreachable;
+    DeliveryResult res = findUnreachable(depot, deliveries, unreachable);
+    if (res != DELIVERY_SUCCESS)
+        return res;
+
+    orderStops(depot, deliveries, output.stops, cancel);
+
+    //find route, one leg per stop plus the way back to the depot
+    size_t numStops = output.stops.size();
+    output.legCommands.resize(numStops + 1);
+    output.legDistances.resize(numStops + 1);
+    size_t firstInterruptedLeg;
+    res = routeLegs(depot, output.stops, vector<bool>(numStops + 1, true),
+        output.legCommands, output.legDistances, cancel, firstInterruptedLeg);
+    if (res != DELIVERY_SUCCESS)
+        return res;
+    if (firstInterruptedLeg <= numStops)
+    {
+        //cut short: keep the legs before the first one that didn't get routed
+        complete = false;
+        unserved.assign(output.stops.begin() + firstInterruptedLeg, output.stops.end());
+        output.stops.erase(output.stops.begin() + firstInterruptedLeg, output.stops.end());
+        output.legCommands.resize(firstInterruptedLeg);
+        output.legDistances.resize(firstInterruptedLeg);
+    }
+    for (size_t k = 0; k < output.legDistances.size(); k++)
+        output.totalDistance += output.legDistances[k];
+    swap(plan, output);
+    return DELIVERY_SUCCESS;
 }
 
 DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
     const GeoCoord& depot,
     const vector<DeliveryRequest>& deliveries,
-    vector<DeliveryCommand>& commands,
+    DeliveryCommandSink& sink,
     double& totalDistanceTravelled) const
 {
-    //if there is no deliveries
+    ScopedTimer planTimer(stat(&PlanStats::planMicros));
+    totalDistanceTravelled = 0;
     if (deliveries.size() == 0)
         return DELIVERY_SUCCESS;
 
+    vector<DeliveryRequest> unreachable;
+    DeliveryResult checked = findUnreachable(depot, deliveries, unreachable);
+    if (checked != DELIVERY_SUCCESS)
+        return checked;
+
+    vector<DeliveryRequest> stops;
+    orderStops(depot, deliveries, stops, nullptr);
+
+    //route the legs on the pool, but hand them to the sink strictly in order,
+    //dropping each route as soon as its commands have been pushed. Routing
+    //counts as done when the last leg is, not when its commands have been
+    //pushed, so that routeMicros means the same as for the other plans.
+    Histogram* routeStat = stat(&PlanStats::routeMicros);
+    chrono::steady_clock::time_point routeStart = chrono::steady_clock::now();
+    size_t numStops = stops.size();
+    vector<list<StreetSegment>> routes(numStops + 1);
+    vector<double> distances(numStops + 1, 0);
+    vector<chrono::steady_clock::time_point> routed(numStops + 1, routeStart);
+    atomic<bool> abandoned(false);
+    vector<future<DeliveryResult>> pending;
+    for (size_t k = 0; k <= numStops; k++)
+    {
+        pending.push_back(pool()->submit([this, &depot, &stops, &routes, &distances, &routed, &abandoned,
+            routeStat, numStops, k]()
+        {
+            const GeoCoord& from = (k == 0 ? depot : stops[k - 1].location);
+            const GeoCoord& to = (k == numStops ? depot : stops[k].location);
+            if (abandoned || from == to)
+                return DELIVERY_SUCCESS;
+            DeliveryResult res;
+            {
+                ScopedTimer legTimer(stat(&PlanStats::legMicros));
+                res = m_router.generatePointToPointRoute(from, to, routes[k], distances[k]);
+            }
+            if (routeStat != nullptr)
+                routed[k] = chrono::steady_clock::now();
+            return res;
+        }));
+    }
+
+    DeliveryResult res = DELIVERY_SUCCESS;
+    for (size_t k = 0; k <= numStops; k++)
+    {
+        DeliveryResult curr = pool()->get(pending[k]);
+        if (res != DELIVERY_SUCCESS)
+            continue;   //only waiting for the abandoned legs now
+        if (curr != DELIVERY_SUCCESS)
+        {
+            res = curr;
+            abandoned = true;
+            continue;
+        }
+        {
+            ScopedTimer commandTimer(stat(&PlanStats::commandMicros));
+            emitLeg(routes[k], (k == numStops ? string() : stops[k].item), sink);
+        }
+        routes[k].clear();
+        totalDistanceTravelled += distances[k];
+    }
+    if (routeStat != nullptr)
+    {
+        routeStat->record(chrono::duration_cast<chrono::microseconds>(
+            *max_element(routed.begin(), routed.end()) - routeStart).count());
+    }
+    return res;
+}
+
+void DeliveryPlannerImpl::orderStops(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+    vector<DeliveryRequest>& stops, const CancellationToken* cancel) const
+{
+    ScopedTimer optimizeTimer(stat(&PlanStats::optimizeMicros));
+    //collapse deliveries to the same spot into a single stop, so that the
+    //optimizer and the router only ever see each location once
+    ExpandableHashMap<GeoCoord, size_t> groupOf;
+    vector<vector<size_t>> groups;
+    vector<DeliveryRequest> uniqueStops;
+    for (size_t k = 0; k < deliveries.size(); k++)
+    {
+        size_t* ptrToGroup = groupOf.find(deliveries[k].location);
+        if (ptrToGroup != nullptr)
+            groups[*ptrToGroup].push_back(k);
+        else
+        {
+            groupOf.associate(deliveries[k].location, groups.size());
+            groups.push_back(vector<size_t>(1, k));
+            uniqueStops.push_back(deliveries[k]);
+        }
+    }
+
     //optimize order
     double distOld, distNew;
-    vector<DeliveryRequest> copyOfDeliveries;
-    for (size_t k = 0; k < deliveries.size(); k++)
+    if (cancel != nullptr)
+        m_optimizer.optimizeDeliveryOrder(depot, uniqueStops, distOld, distNew, *cancel);
+    else
+        m_optimizer.optimizeDeliveryOrder(depot, uniqueStops, distOld, distNew);
+
+    //every item of a stop is delivered back to back
+    for (size_t k = 0; k < uniqueStops.size(); k++)
     {
-        copyOfDeliveries.push_back(deliveries[k]);
+        const vector<size_t>& group = groups[*groupOf.find(uniqueStops[k].location)];
+        for (size_t i = 0; i < group.size(); i++)
+            stops.push_back(deliveries[group[i]]);
     }
-    m_optimizer.optimizeDeliveryOrder(depot, copyOfDeliveries, distOld, distNew);
+}
 
-    //find route
-    double distSegment;
-    totalDistanceTravelled = 0;
-    list<StreetSegment> route;
-    vector<DeliveryCommand> output;
-    DeliveryResult res = createCommands(depot, copyOfDeliveries[0].location, output, 
-        distSegment, copyOfDeliveries[0].item);
+DeliveryResult DeliveryPlannerImpl::insertDeliveries(
+    DeliveryPlan& plan,
+    const vector<DeliveryRequest>& lateDeliveries,
+    vector<DeliveryCommand>& commands,
+    double& totalDistanceTravelled) const
+{
+    ScopedTimer planTimer(stat(&PlanStats::planMicros));
+    vector<DeliveryRequest> unreachable;
+    DeliveryResult checked = findUnreachable(plan.depot, lateDeliveries, unreachable);
+    if (checked != DELIVERY_SUCCESS)
+        return checked;
+
+    //the old plan's legs can only be reused if it has one per stop, plus
+    //perhaps the way back to the depot, which a plan cut short doesn't have;
+    //any other plan is routed afresh. A plan without stops has no legs.
+    size_t numOldLegs = plan.legCommands.size();
+    if (numOldLegs != plan.legDistances.size() ||
+        (numOldLegs != plan.stops.size() + 1 && numOldLegs != plan.stops.size()))
+        numOldLegs = 0;
+    if (plan.stops.empty() && lateDeliveries.empty())
+    {
+        plan.legCommands.clear();
+        plan.legDistances.clear();
+        plan.totalDistance = 0;
+        commands.clear();
+        totalDistanceTravelled = 0;
+        return DELIVERY_SUCCESS;
+    }
+
+    //place every late delivery at its cheapest position by crow distance;
+    //isNew marks the stops whose legs in and out must be re-routed
+    vector<DeliveryRequest> stops = plan.stops;
+    vector<bool> isNew(stops.size(), false);
+    for (size_t i = 0; i < lateDeliveries.size(); i++)
+    {
+        const GeoCoord& loc = lateDeliveries[i].location;
+        size_t bestPos = 0;
+        double bestCost = 0;
+        for (size_t p = 0; p <= stops.size(); p++)
+        {
+            const GeoCoord& prev = (p == 0 ? plan.depot : stops[p - 1].location);
+            const GeoCoord& next = (p == stops.size() ? plan.depot : stops[p].location);
+            double cost = distanceEarthMiles(prev, loc) + distanceEarthMiles(loc, next)
+                - distanceEarthMiles(prev, next);
+            if (p == 0 || cost < bestCost)
+            {
+                bestCost = cost;
+                bestPos = p;
+            }
+        }
+        stops.insert(stops.begin() + bestPos, lateDeliveries[i]);
+        isNew.insert(isNew.begin() + bestPos, true);
+    }
+
+    //route only the legs that start or end at a new stop, or that the old
+    //plan doesn't have; every other leg is carried over from the old plan,
+    //whose leg index trails by the number of new stops seen so far
+    size_t numStops = stops.size();
+    vector<bool> needsRoute(numStops + 1);
+    size_t numNewSoFar = 0;
+    for (size_t k = 0; k <= numStops; k++)
+    {
+        if (k < numStops && isNew[k])
+            numNewSoFar++;
+        needsRoute[k] = (k < numStops && isNew[k]) || (k > 0 && isNew[k - 1]) ||
+            k - numNewSoFar >= numOldLegs;
+    }
+    vector<vector<DeliveryCommand>> legCommands(numStops + 1);
+    vector<double> legDistances(numStops + 1);
+    size_t firstInterruptedLeg;
+    DeliveryResult res = routeLegs(plan.depot, stops, needsRoute, legCommands, legDistances,
+        nullptr, firstInterruptedLeg);
     if (res != DELIVERY_SUCCESS)
         return res;
-    totalDistanceTravelled += distSegment;
 
-    for (size_t k = 1; k < copyOfDeliveries.size(); k++)
+    numNewSoFar = 0;
+    for (size_t k = 0; k <= numStops; k++)
     {
-        res = createCommands(copyOfDeliveries[k - 1].location, copyOfDeliveries[k].location, output,
-            distSegment, copyOfDeliveries[k].item);
-        if (res != DELIVERY_SUCCESS)
-            return res;
-        totalDistanceTravelled += distSegment;
+        if (k < numStops && isNew[k])
+            numNewSoFar++;
+        else if (!needsRoute[k])
+        {
+            swap(legCommands[k], plan.legCommands[k - numNewSoFar]);
+            legDistances[k] = plan.legDistances[k - numNewSoFar];
+        }
+    }
+
+    //commit the new plan
+    swap(plan.stops, stops);
+    swap(plan.legCommands, legCommands);
+    swap(plan.legDistances, legDistances);
+    plan.totalDistance = 0;
+    for (size_t k = 0; k < plan.legDistances.size(); k++)
+        plan.totalDistance += plan.legDistances[k];
+    plan.getCommands(commands);
+    totalDistanceTravelled = plan.totalDistance;
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult DeliveryPlannerImpl::generateDeliveryPlans(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    int numDrivers,
+    vector<vector<DeliveryCommand>>& commands,
+    vector<double>& totalDistances,
+    int maxStopsPerDriver) const
+{
+    if (numDrivers <= 0)
+        return NO_ROUTE;
+    //the drivers can't carry every item between them
+    if (maxStopsPerDriver > 0 && deliveries.size() > static_cast<size_t>(maxStopsPerDriver) * numDrivers)
+        return NO_ROUTE;
+    vector<DeliveryRequest> unreachable;
+    DeliveryResult checked = findUnreachable(depot, deliveries, unreachable);
+    if (checked != DELIVERY_SUCCESS)
+        return checked;
+
+    vector<vector<DeliveryRequest>> clusters;
+    partitionBySweep(depot, deliveries, numDrivers, maxStopsPerDriver > 0 ? maxStopsPerDriver : deliveries.size(),
+        clusters);
+
+    //plan every driver's tour on the pool
+    vector<vector<DeliveryCommand>> output(numDrivers);
+    vector<double> distances(numDrivers, 0);
+    vector<future<DeliveryResult>> results;
+    for (int d = 0; d < numDrivers; d++)
+    {
+        results.push_back(pool()->submit([this, &depot, &clusters, &output, &distances, d]()
+        {
+            return generateDeliveryPlan(depot, clusters[d], output[d], distances[d]);
+        }));
     }
 
-    res = createCommands(copyOfDeliveries[copyOfDeliveries.size() - 1].location, depot, output, 
-        distSegment, "");
+    //wait for all of them before reporting the first failure
+    DeliveryResult res = DELIVERY_SUCCESS;
+    for (int d = 0; d < numDrivers; d++)
+    {
+        DeliveryResult curr = pool()->get(results[d]);
+        if (res == DELIVERY_SUCCESS)
+            res = curr;
+    }
     if (res != DELIVERY_SUCCESS)
         return res;
-    totalDistanceTravelled += distSegment;
     swap(commands, output);
+    swap(totalDistances, distances);
     return DELIVERY_SUCCESS;
 }
 
-DeliveryResult DeliveryPlannerImpl::createCommands(const GeoCoord& start, const GeoCoord& dest,
-    vector<DeliveryCommand>& commands, double& totalDist, string item) const
+DeliveryResult DeliveryPlannerImpl::findUnreachable(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<DeliveryRequest>& unreachable) const
 {
-    //assume it is valid to just append onto commands, no need to reset
-    list<StreetSegment> route;
-    DeliveryResult output = m_router.generatePointToPointRoute(start, dest, route, totalDist);
+    unreachable.clear();
+    if (deliveries.size() == 0)
+        return DELIVERY_SUCCESS;
 
-    //analyze the route
-    StreetSegment currStr = *(route.begin());   //initialize as the first street segment
-    bool shouldGenerateNewProceed = true;
-    for (list<StreetSegment>::iterator it = route.begin(); it != route.end(); it++)
+    size_t depotComponent;
+    if (!m_streetMap->getComponent(depot, depotComponent))
     {
-        DeliveryCommand myCommand;
-        if (it->name != currStr.name)
+        //a tiled map has the depot but can't say what else joins up with it
+        vector<StreetSegment> segs;
+        if (m_streetMap->getSegmentsThatStartWith(depot, segs))
+            return DELIVERY_SUCCESS;
+        unreachable = deliveries;
+        return BAD_COORD;
+    }
+
+    //off the map outranks cut off, as the router checks for it first
+    DeliveryResult res = DELIVERY_SUCCESS;
+    for (size_t k = 0; k < deliveries.size(); k++)
+    {
+        size_t component;
+        if (!m_streetMap->getComponent(deliveries[k].location, component))
         {
-            //going onto a new street
-            double angle = angleBetween2Lines(currStr, *it);
-            if (angle >= 1 && angle < 180)
-            {
-                myCommand.initAsTurnCommand("left", it->name);
-            }
-            else if (angle >= 180 && angle <= 359)
+            unreachable.push_back(deliveries[k]);
+            res = BAD_COORD;
+        }
+        else if (component != depotComponent)
+        {
+            unreachable.push_back(deliveries[k]);
+            if (res == DELIVERY_SUCCESS)
+                res = NO_ROUTE;
+        }
+    }
+    return res;
+}
+
+DeliveryResult DeliveryPlannerImpl::routeLegs(const GeoCoord& depot, const vector<DeliveryRequest>& stops,
+    const vector<bool>& needsRoute, vector<vector<DeliveryCommand>>& legCommands,
+    vector<double>& legDistances, const CancellationToken* cancel, size_t& firstInterruptedLeg) const
+{
+    ScopedTimer routeTimer(stat(&PlanStats::routeMicros));
+    //the legs are independent, so route them all on the pool; legs after
+    //one that already failed are skipped, and the earliest failing leg is
+    //reported just as if they had been routed one after another. A leg that
+    //cancel cut short isn't a failure: the legs after it still check their
+    //ends, and only if none of them fails is the plan cut short there.
+    size_t numStops = stops.size();
+    atomic<size_t> firstFailure(numStops + 1);
+    vector<DeliveryResult> results(numStops + 1, DELIVERY_SUCCESS);
+    vector<char> interrupted(numStops + 1, false);    //not vector<bool>, whose elements share words across threads
+    vector<future<void>> pending;
+    for (size_t k = 0; k <= numStops; k++)
+    {
+        if (!needsRoute[k])
+            continue;
+        pending.push_back(pool()->submit([this, &depot, &stops, &legCommands, &legDistances,
+            &firstFailure, &results, &interrupted, cancel, numStops, k]()
+        {
+            if (k > firstFailure)
+                return;
+            const GeoCoord& from = (k == 0 ? depot : stops[k - 1].location);
+            const GeoCoord& to = (k == numStops ? depot : stops[k].location);
+            string item = (k == numStops ? "" : stops[k].item);
+            bool cutShort;
+            results[k] = createCommands(from, to, legCommands[k], legDistances[k], item, cancel, cutShort);
+            interrupted[k] = cutShort;
+            if (results[k] != DELIVERY_SUCCESS && !cutShort)
             {
-                myCommand.initAsTurnCommand("right", it->name);
+                size_t prev = firstFailure;
+                while (k < prev && !firstFailure.compare_exchange_weak(prev, k))
+                    ;
             }
-            commands.push_back(myCommand);
-            currStr = *it;
-            shouldGenerateNewProceed = true;
+        }));
+    }
+    for (size_t k = 0; k < pending.size(); k++)
+        pool()->get(pending[k]);
+    firstInterruptedLeg = numStops + 1;
+    for (size_t k = 0; k <= numStops; k++)
+    {
+        if (results[k] != DELIVERY_SUCCESS && !interrupted[k])
+            return results[k];
+        if (interrupted[k] && firstInterruptedLeg > numStops)
+            firstInterruptedLeg = k;
+    }
+    return DELIVERY_SUCCESS;
+}
+
+void DeliveryPlannerImpl::partitionBySweep(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries,
+    int numDrivers, size_t maxStopsPerDriver, vector<vector<DeliveryRequest>>& clusters) const
+{
+    clusters.assign(numDrivers, vector<DeliveryRequest>());
+    if (deliveries.size() == 0)
+        return;
+
+    //items for the same spot are swept as one, as orderStops would make
+    //them a single stop anyway
+    ExpandableHashMap<GeoCoord, size_t> groupOf;
+    vector<vector<size_t>> groups;
+    for (size_t k = 0; k < deliveries.size(); k++)
+    {
+        size_t* ptrToGroup = groupOf.find(deliveries[k].location);
+        if (ptrToGroup != nullptr)
+            groups[*ptrToGroup].push_back(k);
+        else
+        {
+            groupOf.associate(deliveries[k].location, groups.size());
+            groups.push_back(vector<size_t>(1, k));
+        }
+    }
+
+    //sort the spots by their bearing from the depot
+    vector<pair<double, size_t>> byAngle;
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        const GeoCoord& loc = deliveries[groups[g][0]].location;
+        double angle = atan2(loc.latitude - depot.latitude, loc.longitude - depot.longitude);
+        byAngle.push_back(make_pair(angle, g));
+    }
+    sort(byAngle.begin(), byAngle.end());
+
+    //start the sweep right after the widest empty wedge, so that no group of
+    //nearby stops is cut in two where the angle wraps around
+    size_t first = 0;
+    double widestGap = byAngle[0].first + deg2rad(360) - byAngle[byAngle.size() - 1].first;
+    for (size_t k = 1; k < byAngle.size(); k++)
+    {
+        double gap = byAngle[k].first - byAngle[k - 1].first;
+        if (gap > widestGap)
+        {
+            widestGap = gap;
+            first = k;
         }
-        if (shouldGenerateNewProceed)
+    }
+
+    //a spot with more items than a driver can carry is split into loads
+    //that fit
+    vector<vector<size_t>> runs;
+    for (size_t k = 0; k < byAngle.size(); k++)
+    {
+        const vector<size_t>& group = groups[byAngle[(first + k) % byAngle.size()].second];
+        for (size_t i = 0; i < group.size(); i += maxStopsPerDriver)
         {
-            //generate a proceed command
-            string direction = getDirection(*it);
-            myCommand.initAsProceedCommand(direction, it->name, distanceEarthMiles(it->start, it->end));
-            commands.push_back(myCommand);
-            shouldGenerateNewProceed = false;
+            size_t last = min(group.size(), i + maxStopsPerDriver);
+            runs.push_back(vector<size_t>(group.begin() + i, group.begin() + last));
         }
-        else
+    }
+
+    //keeping spots whole can leave the last drivers more than they can
+    //carry; dealing out single items never does
+    if (dealRuns(deliveries, runs, maxStopsPerDriver, clusters))
+        return;
+    vector<vector<size_t>> items;
+    for (size_t r = 0; r < runs.size(); r++)
+    {
+        for (size_t i = 0; i < runs[r].size(); i++)
+            items.push_back(vector<size_t>(1, runs[r][i]));
+    }
+    dealRuns(deliveries, items, maxStopsPerDriver, clusters);
+}
+
+//deal out consecutive runs of the sweep as evenly as possible, each driver
+//taking runs until it has its share of the items left, or at least one run;
+//false if the drivers can't carry them all that way
+bool DeliveryPlannerImpl::dealRuns(const vector<DeliveryRequest>& deliveries, const vector<vector<size_t>>& runs,
+    size_t maxStopsPerDriver, vector<vector<DeliveryRequest>>& clusters) const
+{
+    size_t numDrivers = clusters.size();
+    size_t left = deliveries.size();
+    size_t r = 0;
+    for (size_t d = 0; d < numDrivers; d++)
+    {
+        clusters[d].clear();
+        size_t share = left / (numDrivers - d) + (left % (numDrivers - d) != 0 ? 1 : 0);
+        while (r < runs.size() && clusters[d].size() + runs[r].size() <=
+            (clusters[d].empty() ? maxStopsPerDriver : min(share, maxStopsPerDriver)))
+        {
+            for (size_t i = 0; i < runs[r].size(); i++)
+                clusters[d].push_back(deliveries[runs[r][i]]);
+            left -= runs[r].size();
+            r++;
+        }
+    }
+    return r == runs.size();
+}
+
+//turns the planner's steps back into DeliveryCommands
+class DeliveryCommandCollector : public DeliveryCommandSink
+{
+public:
+    DeliveryCommandCollector(vector<DeliveryCommand>& commands)
+        :m_commands(commands)
+    {}
+
+    void accept(const DeliveryStep& step)
+    {
+        DeliveryCommand myCommand;
+        switch (step.type)
         {
-            //increase the distance of the previous proceed command
-            commands[commands.size() - 1].increaseDistance(distanceEarthMiles(it->start, it->end));
+        case DeliveryStep::PROCEED:
+            myCommand.initAsProceedCommand(step.direction, *step.streetName, step.distance);
+            break;
+        case DeliveryStep::TURN:
+            myCommand.initAsTurnCommand(step.direction, *step.streetName);
+            break;
+        case DeliveryStep::DELIVER:
+            myCommand.initAsDeliverCommand(*step.item);
+            break;
         }
+        m_commands.push_back(myCommand);
     }
 
+private:
+    vector<DeliveryCommand>& m_commands;
+};
+
+DeliveryResult DeliveryPlannerImpl::createCommands(const GeoCoord& start, const GeoCoord& dest,
+    vector<DeliveryCommand>& commands, double& totalDist, string item,
+    const CancellationToken* cancel, bool& interrupted) const
+{
+    //assume it is valid to just append onto commands, no need to reset
+    list<StreetSegment> route;
+    totalDist = 0;
+    interrupted = false;
+    //another item for the stop we are already at needs no driving
+    if (start != dest)
+    {
+        //a cancelled plan gives up on its searches straight away, but only
+        //after they have checked the leg's ends
+        ScopedTimer legTimer(stat(&PlanStats::legMicros));
+        DeliveryResult output = (cancel != nullptr ?
+            m_router.generatePointToPointRoute(start, dest, route, totalDist, *cancel, interrupted) :
+            m_router.generatePointToPointRoute(start, dest, route, totalDist));
+        if (output != DELIVERY_SUCCESS)
+            return output;
+    }
+    ScopedTimer commandTimer(stat(&PlanStats::commandMicros));
+    DeliveryCommandCollector collector(commands);
+    emitLeg(route, item, collector);
+    return DELIVERY_SUCCESS;
+}
+
+void DeliveryPlannerImpl::emitLeg(const list<StreetSegment>& route, const string& item,
+    DeliveryCommandSink& sink) const
+{
+    //analyze the route; a proceed step is held back until we leave its
+    //street, so that it carries the distance along the whole street
+    const StreetSegment* currStr = nullptr;
+    DeliveryStep proceed;
+    for (list<StreetSegment>::const_iterator it = route.begin(); it != route.end(); it++)
+    {
+        if (currStr != nullptr && it->name == currStr->name)
+        {
+            proceed.distance += distanceEarthMiles(it->start, it->end);
+            sink.acceptSegment(*it);
+            continue;
+        }
+        if (currStr != nullptr)
+        {
+            //going onto a new street
+            sink.accept(proceed);
+            double angle = angleBetween2Lines(*currStr, *it);
+            DeliveryStep turn = { DeliveryStep::TURN, nullptr, &it->name, nullptr, 0 };
+            if (angle >= 1 && angle < 180)
+                turn.direction = "left";
+            else if (angle >= 180 && angle <= 359)
+                turn.direction = "right";
+            if (turn.direction != nullptr)
+                sink.accept(turn);
+        }
+        currStr = &*it;
+        proceed = { DeliveryStep::PROCEED, getDirection(*it), &it->name, nullptr,
+            distanceEarthMiles(it->start, it->end) };
+        sink.acceptSegment(*it);
+    }
+    if (currStr != nullptr)
+        sink.accept(proceed);
+
     //delivering the item
     if (item.length() != 0)
     {
-        DeliveryCommand delivery;
-        delivery.initAsDeliverCommand(item);
-        commands.push_back(delivery);
+        DeliveryStep delivery = { DeliveryStep::DELIVER, nullptr, nullptr, &item, 0 };
+        sink.accept(delivery);
     }
-    return output;
 }
 
-string DeliveryPlannerImpl::getDirection(const StreetSegment& street) const
+const char* DeliveryPlannerImpl::getDirection(const StreetSegment& street) const
 {
     double angle = angleOfLine(street);
-    string output;
+    const char* output = "east";
     if (angle >= 0 && angle < 22.5)
         output = "east";
     else if (angle >= 22.5 && angle < 67.5)
@@ -159,14 +750,43 @@ string DeliveryPlannerImpl::getDirection(const StreetSegment& street) const
     return output;
 }
 
+void DeliveryPlannerImpl::setStats(PlanStats* stats)
+{
+    m_stats = stats;
+    m_router.setStats(stats);
+}
+
+void DeliveryPlannerImpl::warmUp() const
+{
+    m_router.warmUp();
+}
+
+//the pool to route on; planners given none all share one, started the first
+//time any of them plans, rather than each starting a thread per core
+ThreadPool* DeliveryPlannerImpl::pool() const
+{
+    if (m_pool != nullptr)
+        return m_pool;
+    static ThreadPool defaultPool;
+    return &defaultPool;
+}
+
+//the histogram to record into, or nullptr when no stats are attached
+Histogram* DeliveryPlannerImpl::stat(Histogram PlanStats::* which) const
+{
+    if (!GOOBEREATS_STATS_ENABLED || m_stats == nullptr)
+        return nullptr;
+    return &(m_stats->*which);
+}
+
 //******************** DeliveryPlanner functions ******************************
 
 // These functions simply delegate to DeliveryPlannerImpl's functions.
 // You probably don't want to change any of this code.
 
-DeliveryPlanner::DeliveryPlanner(const StreetMap* sm)
+DeliveryPlanner::DeliveryPlanner(const StreetMap* sm, ThreadPool* pool)
 {
-    m_impl = new DeliveryPlannerImpl(sm);
+    m_impl = new DeliveryPlannerImpl(sm, pool);
 }
 
 DeliveryPlanner::~DeliveryPlanner()
@@ -182,3 +802,67 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
 {
     return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled);
 }
+
+DeliveryResult DeliveryPlanner::generateDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryPlan& plan) const
+{
+    return m_impl->generateDeliveryPlan(depot, deliveries, plan);
+}
+
+DeliveryResult DeliveryPlanner::generateDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryCommandSink& sink,
+    double& totalDistanceTravelled) const
+{
+    return m_impl->generateDeliveryPlan(depot, deliveries, sink, totalDistanceTravelled);
+}
+
+DeliveryResult DeliveryPlanner::insertDeliveries(
+    DeliveryPlan& plan,
+    const vector<DeliveryRequest>& lateDeliveries,
+    vector<DeliveryCommand>& commands,
+    double& totalDistanceTravelled) const
+{
+    return m_impl->insertDeliveries(plan, lateDeliveries, commands, totalDistanceTravelled);
+}
+
+DeliveryResult DeliveryPlanner::generateDeliveryPlans(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    int numDrivers,
+    vector<vector<DeliveryCommand>>& commands,
+    vector<double>& totalDistances,
+    int maxStopsPerDriver) const
+{
+    return m_impl->generateDeliveryPlans(depot, deliveries, numDrivers, commands, totalDistances,
+        maxStopsPerDriver);
+}
+
+DeliveryResult DeliveryPlanner::findUnreachable(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<DeliveryRequest>& unreachable) const
+{
+    return m_impl->findUnreachable(depot, deliveries, unreachable);
+}
+
+future<AsyncPlanResult> DeliveryPlanner::generateDeliveryPlanAsync(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    CancellationToken cancel) const
+{
+    return m_impl->generateDeliveryPlanAsync(depot, deliveries, cancel);
+}
+
+void DeliveryPlanner::setStats(PlanStats* stats)
+{
+    m_impl->setStats(stats);
+}
+
+void DeliveryPlanner::warmUp() const
+{
+    m_impl->warmUp();
+}
@@ -15,6 +15,8 @@ public:
 	~ExpandableHashMap();
 	void reset();
 	int size() const;
+	// make room for n associations in all, so that adding them won't rehash
+	void reserve(size_t n);
 	void associate(const KeyType& key, const ValueType& value);
 
 	// for a map that can't be modified, return a pointer to const ValueType
@@ -26,6 +28,13 @@ public:
 		return const_cast<ValueType*>(const_cast<const ExpandableHashMap*>(this)->find(key));
 	}
 
+	// same as above, also adding the number of keys compared to probes
+	const ValueType* find(const KeyType& key, size_t& probes) const;
+	ValueType* find(const KeyType& key, size_t& probes)
+	{
+		return const_cast<ValueType*>(const_cast<const ExpandableHashMap*>(this)->find(key, probes));
+	}
+
 	// C++11 syntax for preventing copying and assignment
 	ExpandableHashMap(const ExpandableHashMap&) = delete;
 	ExpandableHashMap& operator=(const ExpandableHashMap&) = delete;
@@ -34,6 +43,7 @@ private:
 	std::vector<std::list<std::pair<KeyType, ValueType>>> m_map;
 	size_t m_size;
 	double m_maxLoadFactor;
+	void rehash(size_t numBuckets);
 	unsigned int getBucketNumber(const KeyType& key) const
 	{
 		unsigned int hasher(const KeyType& k);
@@ -86,23 +96,49 @@ void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const
 
 	//rehash if necessary
 	if (static_cast<double>(m_size) / m_map.size() > m_maxLoadFactor)
+		rehash(m_map.size() * 2);
+}
+
+template<typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::reserve(size_t n)
+{
+	size_t numBuckets = m_map.size();
+	while (static_cast<double>(n) / numBuckets > m_maxLoadFactor)
+		numBuckets *= 2;
+	if (numBuckets > m_map.size())
+		rehash(numBuckets);
+}
+
+template<typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::rehash(size_t numBuckets)
+{
+	//move the list nodes themselves across rather than copying them
+	std::vector<std::list<std::pair<KeyType, ValueType>>> temp(numBuckets);
+	std::swap(m_map, temp);
+	for (size_t k = 0; k < temp.size(); k++)
 	{
-		std::vector<std::list<std::pair<KeyType, ValueType>>> temp(m_map.size() * 2);
-		std::swap(m_map, temp);
-		for (size_t k = 0; k < temp.size(); k++)
+		while (!temp[k].empty())
 		{
-			for (auto it = temp[k].begin(); it != temp[k].end(); it++)
-				m_map[getBucketNumber(it->first)].emplace_back(it->first, it->second);
+			std::list<std::pair<KeyType, ValueType>>& bucket = m_map[getBucketNumber(temp[k].front().first)];
+			bucket.splice(bucket.end(), temp[k], temp[k].begin());
 		}
 	}
 }
 
 template<typename KeyType, typename ValueType>
 const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key) const
+{
+	size_t probes = 0;
+	return find(key, probes);
+}
+
+template<typename KeyType, typename ValueType>
+const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key, size_t& probes) const
 {
 	unsigned int bucketNum = getBucketNumber(key);
 	for (auto it = m_map[bucketNum].begin(); it != m_map[bucketNum].end(); it++)
 	{
+		probes++;
 		if (it->first == key)
 			return &(it->second);
 	}
@@ -0,0 +1,411 @@
+#include "PlanServer.h"
+#include "ThreadPool.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+bool readDeliveryRequests(istream& inf, GeoCoord& depot, vector<DeliveryRequest>& v, ostream& diag);
+DeliveryResult describePlan(const DeliveryPlanner& dp, const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries, string& text);
+
+const uint32_t MAX_MESSAGE_LENGTH = 16 * 1024 * 1024;
+const int WRITE_TIMEOUT_MS = 5000;  //for a client to take a response
+
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int)
+{
+    stopRequested = 1;
+}
+
+bool readFully(int fd, char* buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// On a non-blocking socket, waits up to timeoutMs each time the client
+// isn't taking any more, then gives up on it.
+bool writeFully(int fd, const char* buf, size_t len, int timeoutMs = -1)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            pollfd pfd = { fd, POLLOUT, 0 };
+            int ready = poll(&pfd, 1, timeoutMs);
+            if (ready < 0 && errno == EINTR)
+                continue;
+            if (ready <= 0)
+                return false;
+            continue;
+        }
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool readMessage(int fd, string& payload)
+{
+    unsigned char header[4];
+    if (!readFully(fd, reinterpret_cast<char*>(header), 4))
+        return false;
+    uint32_t len = (uint32_t(header[0]) << 24) | (uint32_t(header[1]) << 16) | (uint32_t(header[2]) << 8) | header[3];
+    if (len > MAX_MESSAGE_LENGTH)
+        return false;
+    payload.resize(len);
+    return len == 0 || readFully(fd, &payload[0], len);
+}
+
+bool writeMessage(int fd, const string& payload, int timeoutMs = -1)
+{
+    uint32_t len = payload.size();
+    char header[4] = { char(len >> 24), char(len >> 16), char(len >> 8), char(len) };
+    return writeFully(fd, header, 4, timeoutMs) && writeFully(fd, payload.data(), payload.size(), timeoutMs);
+}
+
+// A client connection to the server, and what has arrived of its requests.
+struct Connection
+{
+    int fd;
+    string in;      //read, but not yet handed to a worker
+    bool busy;      //a worker has its request
+    bool done;      //nothing more will be read; close once no worker has it
+};
+
+// Read whatever the client has sent, without waiting for more.
+void readAvailable(Connection& conn)
+{
+    char buf[64 * 1024];
+    for (;;)
+    {
+        ssize_t n = read(conn.fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0)
+        {
+            //requests that arrived whole are still answered
+            conn.done = true;
+            return;
+        }
+        conn.in.append(buf, n);
+        if (size_t(n) < sizeof(buf))
+            return;
+    }
+}
+
+// Give up on the client, and whatever else it has sent.
+void dropConnection(Connection& conn)
+{
+    conn.in.clear();
+    conn.done = true;
+}
+
+// Take the next whole request off what the client has sent. False if it
+// hasn't all arrived; bad is set if it never can, being too long.
+bool takeMessage(Connection& conn, string& payload, bool& bad)
+{
+    bad = false;
+    if (conn.in.size() < 4)
+        return false;
+    const unsigned char* header = reinterpret_cast<const unsigned char*>(conn.in.data());
+    uint32_t len = (uint32_t(header[0]) << 24) | (uint32_t(header[1]) << 16) | (uint32_t(header[2]) << 8) | header[3];
+    if (len > MAX_MESSAGE_LENGTH)
+    {
+        bad = true;
+        return false;
+    }
+    if (conn.in.size() - 4 < len)
+        return false;
+    payload = conn.in.substr(4, len);
+    conn.in.erase(0, 4 + size_t(len));
+    return true;
+}
+
+int openSocket(const string& socketPath, sockaddr_un& addr)
+{
+    if (socketPath.size() >= sizeof(addr.sun_path))
+    {
+        cout << "Socket path too long: " << socketPath << endl;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketPath.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        cout << "Unable to create socket: " << strerror(errno) << endl;
+    return fd;
+}
+
+string handleRequest(const DeliveryPlanner& dp, const string& payload)
+{
+    string response(1, char(PLAN_BAD_REQUEST));
+    try
+    {
+        istringstream in(payload);
+        ostringstream diag;
+        GeoCoord depot;
+        vector<DeliveryRequest> deliveries;
+        if (!readDeliveryRequests(in, depot, deliveries, diag))
+        {
+            response += "Missing depot in delivery requests.\n";
+            return response;
+        }
+        response += diag.str();
+        response[0] = char(describePlan(dp, depot, deliveries, response));
+    }
+    catch (const exception&)
+    {
+        //a coordinate that isn't a number
+        response.resize(1);
+        response[0] = char(PLAN_BAD_REQUEST);
+        response += "Bad number in delivery requests.\n";
+    }
+    return response;
+}
+
+int runPlanServer(const DeliveryPlanner& dp, string socketPath, unsigned int numWorkers, size_t maxQueued)
+{
+    sockaddr_un addr;
+    int listenFd = openSocket(socketPath, addr);
+    if (listenFd < 0)
+        return 1;
+    unlink(socketPath.c_str());
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listenFd, 128) < 0)
+    {
+        cout << "Unable to listen on " << socketPath << ": " << strerror(errno) << endl;
+        close(listenFd);
+        return 1;
+    }
+
+    //workers hand connections back to the polling thread through this pipe
+    int wakePipe[2];
+    if (pipe(wakePipe) < 0)
+    {
+        cout << "Unable to create pipe: " << strerror(errno) << endl;
+        close(listenFd);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = requestStop;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    cerr << "Serving plans on " << socketPath << endl;
+
+    //every connection is non-blocking, so this thread only ever reads what
+    //has arrived, and a client sending slowly or stopping half way through
+    //a request holds up no one but itself; workers get whole requests
+    vector<Connection> conns;
+    vector<pair<int, bool>> returned;   //connections a worker has finished with, and whether to keep them
+    mutex returnedMutex;
+    size_t inFlight = 0;
+    {
+        ThreadPool workers(numWorkers);
+        if (numWorkers == 0)
+            numWorkers = max(thread::hardware_concurrency(), 1u);
+        size_t maxInFlight = numWorkers + maxQueued;
+
+        while (!stopRequested)
+        {
+            vector<pollfd> fds;
+            fds.push_back({ listenFd, POLLIN, 0 });
+            fds.push_back({ wakePipe[0], POLLIN, 0 });
+            for (size_t k = 0; k < conns.size(); k++)
+            {
+                //a negative fd is left out of the poll
+                bool reading = !conns[k].busy && !conns[k].done;
+                fds.push_back({ reading ? conns[k].fd : -1, POLLIN, 0 });
+            }
+            if (poll(fds.data(), fds.size(), 200) <= 0)
+            {
+                //timed out or interrupted by a signal
+                for (size_t k = 0; k < fds.size(); k++)
+                    fds[k].revents = 0;
+            }
+
+            //read what has arrived; a connection stays in conns, and keeps
+            //its index, until it is closed below
+            for (size_t k = 0; k < conns.size(); k++)
+            {
+                if (fds[k + 2].revents != 0)
+                    readAvailable(conns[k]);
+            }
+
+            //take back the connections the workers are done with; the pipe
+            //only serves to cut the poll short
+            if (fds[1].revents != 0)
+            {
+                char drain[64];
+                ssize_t ignored = read(wakePipe[0], drain, sizeof(drain));
+                (void)ignored;
+            }
+            {
+                lock_guard<mutex> lock(returnedMutex);
+                for (size_t r = 0; r < returned.size(); r++)
+                {
+                    for (size_t k = 0; k < conns.size(); k++)
+                    {
+                        if (conns[k].fd == returned[r].first)
+                        {
+                            conns[k].busy = false;
+                            if (!returned[r].second)
+                                dropConnection(conns[k]);
+                        }
+                    }
+                    inFlight--;
+                }
+                returned.clear();
+            }
+
+            //hand each whole request to a worker; a connection is owned by
+            //exactly one worker from then until its response is written
+            vector<Connection> stillOpen;
+            for (size_t k = 0; k < conns.size(); k++)
+            {
+                Connection& conn = conns[k];
+                string request;
+                bool bad = false;
+                while (!conn.busy && takeMessage(conn, request, bad))
+                {
+                    if (inFlight >= maxInFlight)
+                    {
+                        //push back on the client rather than queueing without
+                        //bound; one that isn't reading its responses is dropped
+                        if (!writeMessage(conn.fd, string(1, char(PLAN_BUSY)), 0))
+                            dropConnection(conn);
+                        continue;
+                    }
+                    inFlight++;
+                    conn.busy = true;
+                    int fd = conn.fd;
+                    workers.submit([&dp, &returned, &returnedMutex, &wakePipe, fd, request = move(request)]()
+                    {
+                        bool keepOpen = writeMessage(fd, handleRequest(dp, request), WRITE_TIMEOUT_MS);
+                        {
+                            lock_guard<mutex> lock(returnedMutex);
+                            returned.push_back(make_pair(fd, keepOpen));
+                        }
+                        char wake = 0;
+                        ssize_t ignored = write(wakePipe[1], &wake, 1);
+                        (void)ignored;
+                    });
+                }
+                if (bad)
+                    dropConnection(conn);
+                //a worker closing a connection would let its fd be reused
+                //under us, so only this thread closes them
+                if (conn.done && !conn.busy)
+                    close(conn.fd);
+                else
+                    stillOpen.push_back(conn);
+            }
+            swap(conns, stillOpen);
+
+            if (fds[0].revents != 0)
+            {
+                int fd = accept(listenFd, nullptr, nullptr);
+                if (fd >= 0)
+                {
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                    Connection conn;
+                    conn.fd = fd;
+                    conn.busy = false;
+                    conn.done = false;
+                    conns.push_back(conn);
+                }
+            }
+        }
+    }   //the pool finishes the requests in flight before going away
+
+    for (size_t k = 0; k < conns.size(); k++)
+        close(conns[k].fd);
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    close(listenFd);
+    unlink(socketPath.c_str());
+    cerr << "Server stopped" << endl;
+    return 0;
+}
+
+int runPlanClient(string socketPath, const vector<string>& deliveriesFiles)
+{
+    sockaddr_un addr;
+    int fd = openSocket(socketPath, addr);
+    if (fd < 0)
+        return 1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        cout << "Unable to connect to " << socketPath << ": " << strerror(errno) << endl;
+        close(fd);
+        return 1;
+    }
+
+    int exitCode = 0;
+    for (size_t k = 0; k < deliveriesFiles.size(); k++)
+    {
+        ifstream inf(deliveriesFiles[k]);
+        if (!inf)
+        {
+            cout << "Unable to load delivery request file " << deliveriesFiles[k] << endl;
+            exitCode = 1;
+            continue;
+        }
+        ostringstream contents;
+        contents << inf.rdbuf();
+
+        auto start = chrono::steady_clock::now();
+        string response;
+        if (!writeMessage(fd, contents.str()) || !readMessage(fd, response) || response.empty())
+        {
+            cout << "Lost connection to " << socketPath << endl;
+            close(fd);
+            return 1;
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        if (response[0] == char(PLAN_BUSY))
+            cout << "Server busy, try again later." << endl;
+        else
+            cout << response.substr(1);
+        if (response[0] != char(PLAN_SUCCESS))
+            exitCode = 1;
+        cerr << deliveriesFiles[k] << ": " << ms << " ms" << endl;
+    }
+    close(fd);
+    return exitCode;
+}
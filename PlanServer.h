@@ -0,0 +1,38 @@
+// PlanServer.h
+
+#ifndef PLANSERVER_H
+#define PLANSERVER_H
+
+#include "provided.h"
+#include <string>
+#include <vector>
+
+// A planning daemon that keeps one loaded StreetMap warm and serves plan
+// requests over a Unix domain socket.
+//
+// Every message in either direction is a 4-byte big-endian payload length
+// followed by the payload. A request payload is the text of a deliveries
+// file (depot line, then one "lat lon:item" line per delivery). A response
+// payload is one status byte followed by the same text the command line
+// tool prints for that plan. A connection may carry any number of requests.
+enum PlanStatus
+{
+    PLAN_SUCCESS = DELIVERY_SUCCESS,
+    PLAN_NO_ROUTE = NO_ROUTE,
+    PLAN_BAD_COORD = BAD_COORD,
+    PLAN_BAD_REQUEST,   // the payload is not a valid deliveries file
+    PLAN_BUSY           // too many requests queued; try again later
+};
+
+// Serve until SIGINT or SIGTERM. Returns the process exit code. A request
+// goes to a worker only once all of it has arrived, so a slow client holds
+// up no one else; a client that won't take its response within a few
+// seconds is dropped.
+int runPlanServer(const DeliveryPlanner& dp, std::string socketPath,
+    unsigned int numWorkers = 0, size_t maxQueued = 64);
+
+// Send each deliveries file over one connection and print the responses.
+// Returns the process exit code.
+int runPlanClient(std::string socketPath, const std::vector<std::string>& deliveriesFiles);
+
+#endif // !PLANSERVER_H
@@ -0,0 +1,207 @@
+// PlanStats.h
+
+#ifndef PLANSTATS_H
+#define PLANSTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+// Statistics are opt-in: nothing is recorded unless a PlanStats is attached
+// with DeliveryPlanner::setStats or PointToPointRouter::setStats. Building
+// with GOOBEREATS_NO_STATS defined compiles the hooks out altogether.
+#ifdef GOOBEREATS_NO_STATS
+#define GOOBEREATS_STATS_ENABLED 0
+#else
+#define GOOBEREATS_STATS_ENABLED 1
+#endif
+
+// A histogram of non-negative integers that may be updated from several
+// threads at once. Buckets are exact below 8 and then split every power of
+// two into 8 equal parts, so percentiles are within 12.5% of the truth.
+class Histogram
+{
+public:
+    Histogram()
+        : m_count(0), m_sum(0), m_max(0)
+    {
+        for (int k = 0; k < NUM_BUCKETS; k++)
+            m_buckets[k] = 0;
+    }
+
+    void record(uint64_t value)
+    {
+        m_buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t prevMax = m_max.load(std::memory_order_relaxed);
+        while (value > prevMax && !m_max.compare_exchange_weak(prevMax, value, std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t count() const { return m_count.load(); }
+    uint64_t sum() const { return m_sum.load(); }
+    uint64_t max() const { return m_max.load(); }
+    double mean() const { return count() == 0 ? 0 : static_cast<double>(sum()) / count(); }
+
+    // the lower bound of the bucket holding the p-th percentile
+    uint64_t percentile(double p) const
+    {
+        uint64_t total = count();
+        if (total == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(p / 100 * total + 0.999999);
+        if (rank == 0)
+            rank = 1;
+        uint64_t seen = 0;
+        for (int k = 0; k < NUM_BUCKETS; k++)
+        {
+            seen += m_buckets[k].load();
+            if (seen >= rank)
+                return k == NUM_BUCKETS - 1 ? max() : std::min(lowerBound(k), max());
+        }
+        return max();
+    }
+
+    // C++11 syntax for preventing copying and assignment
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+private:
+    static const int NUM_BUCKETS = 8 + 61 * 8;
+    std::atomic<uint64_t> m_buckets[NUM_BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+
+    static int bucketOf(uint64_t value)
+    {
+        if (value < 8)
+            return static_cast<int>(value);
+        int exponent = 63 - __builtin_clzll(value);     //at least 3
+        return 8 + (exponent - 3) * 8 + static_cast<int>((value >> (exponent - 3)) & 7);
+    }
+
+    static uint64_t lowerBound(int bucket)
+    {
+        if (bucket < 8)
+            return bucket;
+        int exponent = (bucket - 8) / 8 + 3;
+        return (uint64_t(8 + (bucket - 8) % 8)) << (exponent - 3);
+    }
+};
+
+// What one point-to-point search did.
+struct RouteQueryStats
+{
+    size_t nodesExpanded = 0;
+    size_t heapPushes = 0;
+    size_t heapPops = 0;
+    size_t hashProbes = 0;      // keys compared in the router's own search maps
+    size_t maxFrontier = 0;     // largest size of the priority queue
+};
+
+// Counters and histograms aggregated over every search and plan made while
+// attached. All times are wall-clock microseconds.
+class PlanStats
+{
+public:
+    PlanStats()
+        : queries(0), nodesExpanded(0), heapPushes(0), heapPops(0), hashProbes(0)
+    {}
+
+    // router, one sample per point-to-point search
+    std::atomic<uint64_t> queries;
+    std::atomic<uint64_t> nodesExpanded;
+    std::atomic<uint64_t> heapPushes;
+    std::atomic<uint64_t> heapPops;
+    std::atomic<uint64_t> hashProbes;
+    Histogram queryNodesExpanded;
+    Histogram queryHashProbes;
+    Histogram queryMaxFrontier;
+    Histogram queryMicros;
+
+    // planner
+    Histogram planMicros;       // one whole plan
+    Histogram optimizeMicros;   // ordering the stops, per plan
+    Histogram routeMicros;      // routing every leg, per plan
+    Histogram legMicros;        // the router's search, per leg
+    Histogram commandMicros;    // turning a route into commands, per leg
+
+    void recordQuery(const RouteQueryStats& q, uint64_t micros)
+    {
+        queries.fetch_add(1, std::memory_order_relaxed);
+        nodesExpanded.fetch_add(q.nodesExpanded, std::memory_order_relaxed);
+        heapPushes.fetch_add(q.heapPushes, std::memory_order_relaxed);
+        heapPops.fetch_add(q.heapPops, std::memory_order_relaxed);
+        hashProbes.fetch_add(q.hashProbes, std::memory_order_relaxed);
+        queryNodesExpanded.record(q.nodesExpanded);
+        queryHashProbes.record(q.hashProbes);
+        queryMaxFrontier.record(q.maxFrontier);
+        queryMicros.record(micros);
+    }
+
+    void dump(std::ostream& out) const
+    {
+        out << "router: " << queries << " searches, " << nodesExpanded << " nodes expanded, "
+            << heapPushes << " heap pushes, " << heapPops << " heap pops, " << hashProbes << " hash probes\n";
+        dumpHistogram(out, "  nodes expanded", queryNodesExpanded);
+        dumpHistogram(out, "  hash probes", queryHashProbes);
+        dumpHistogram(out, "  max frontier", queryMaxFrontier);
+        dumpHistogram(out, "  search us", queryMicros);
+        out << "planner:\n";
+        dumpHistogram(out, "  plan us", planMicros);
+        dumpHistogram(out, "  optimize us", optimizeMicros);
+        dumpHistogram(out, "  route us", routeMicros);
+        dumpHistogram(out, "  leg us", legMicros);
+        dumpHistogram(out, "  command build us", commandMicros);
+    }
+
+    // C++11 syntax for preventing copying and assignment
+    PlanStats(const PlanStats&) = delete;
+    PlanStats& operator=(const PlanStats&) = delete;
+
+private:
+    static void dumpHistogram(std::ostream& out, const char* name, const Histogram& h)
+    {
+        out << name << ": n " << h.count() << ", mean " << static_cast<uint64_t>(h.mean() + 0.5)
+            << ", p50 " << h.percentile(50) << ", p90 " << h.percentile(90) << ", p99 " << h.percentile(99)
+            << ", max " << h.max() << "\n";
+    }
+};
+
+inline uint64_t microsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Records the time from its construction to its destruction into a
+// histogram, or does nothing if the histogram is nullptr.
+class ScopedTimer
+{
+public:
+    ScopedTimer(Histogram* histogram)
+        : m_histogram(GOOBEREATS_STATS_ENABLED ? histogram : nullptr)
+    {
+        if (m_histogram != nullptr)
+            m_start = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedTimer()
+    {
+        if (m_histogram != nullptr)
+            m_histogram->record(microsSince(m_start));
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Histogram* m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif // !PLANSTATS_H
@@ -1,8 +1,15 @@
 #include "provided.h"
 #include "ExpandableHashMap.h"
+#include "PlanStats.h"
+#include "ChainGraph.h"
 #include <list>
+#include <mutex>
+#include <atomic>
+#include <future>
 #include <queue>
 #include <utility>
+#include <chrono>
+#include <algorithm>
 using namespace std;
 
 class PointToPointRouterImpl
@@ -14,32 +21,82 @@ public:
         const GeoCoord& start,
         const GeoCoord& end,
         list<StreetSegment>& route,
-        double& totalDistanceTravelled) const;
+        double& totalDistanceTravelled,
+        const CancellationToken* cancel,
+        bool& interrupted) const;
+    void setStats(PlanStats* stats);
+    void setChainContraction(bool on);
+    void warmUp() const;
 private:
     const StreetMap* m_streetMap;
+    PlanStats* m_stats;
+    bool m_contractChains;
+    mutable once_flag m_chainGraphBuilt;
+    mutable ChainGraph* m_chainGraph;
+    mutable atomic<bool> m_chainGraphReady;     //m_chainGraph is final
+    mutable once_flag m_backgroundStarted;
+    mutable future<void> m_backgroundBuild;     //started by a search that couldn't wait
+
+    const ChainGraph* chainGraph(const CancellationToken* cancel) const;
+    void buildChainGraph() const;
+    void recordQuery(const RouteQueryStats& q, chrono::steady_clock::time_point queryStart) const;
 };
 
 PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm)
-    :m_streetMap(sm)
+    :m_streetMap(sm), m_stats(nullptr), m_contractChains(true), m_chainGraph(nullptr), m_chainGraphReady(false)
 {
 }
 
 PointToPointRouterImpl::~PointToPointRouterImpl()
 {
+    if (m_backgroundBuild.valid())
+        m_backgroundBuild.wait();
+    delete m_chainGraph;
 }
 
 DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
     const GeoCoord& start,
     const GeoCoord& end,
     list<StreetSegment>& route,
-    double& totalDistanceTravelled) const
+    double& totalDistanceTravelled,
+    const CancellationToken* cancel,
+    bool& interrupted) const
 {
     vector<StreetSegment> v;
+    interrupted = false;
 
     //check if start and end are valid
     if (!m_streetMap->getSegmentsThatStartWith(start, v) || !m_streetMap->getSegmentsThatStartWith(end, v))
         return BAD_COORD;
 
+    //no search joins two pieces of the map
+    size_t startComponent, endComponent;
+    if (m_streetMap->getComponent(start, startComponent) && m_streetMap->getComponent(end, endComponent) &&
+        startComponent != endComponent)
+        return NO_ROUTE;
+
+    //we're already there
+    if (start == end)
+    {
+        route.clear();
+        totalDistanceTravelled = 0;
+        return DELIVERY_SUCCESS;
+    }
+
+    RouteQueryStats q;
+    chrono::steady_clock::time_point queryStart;
+    if (GOOBEREATS_STATS_ENABLED && m_stats != nullptr)
+        queryStart = chrono::steady_clock::now();
+
+    //search only the intersections when we can
+    const ChainGraph* graph = chainGraph(cancel);
+    if (graph != nullptr)
+    {
+        DeliveryResult res = graph->route(start, end, route, totalDistanceTravelled, cancel, interrupted, q);
+        recordQuery(q, queryStart);
+        return res;
+    }
+
     //Using the A* searching algorithm
     //the heuristic function is the Euclidean distance between that GeoCoord and the end
     priority_queue<pair<double, GeoCoord>, vector<pair<double, GeoCoord>>, 
@@ -47,17 +104,27 @@ DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
 
     //push the start into the priority queue
     coordToExamine.push(make_pair(distanceEarthMiles(start, end), start));
+    q.heapPushes++;
+    q.maxFrontier = 1;
 
     //the value represents the cost of getting to that GeoCoord
     ExpandableHashMap<GeoCoord, double> coordVisited;   
     coordVisited.associate(start, 0);   //dropping breadcrumbs
     ExpandableHashMap<GeoCoord, GeoCoord> locationsOfPreviousWayPoint;  //for backtracking purposes
+    ExpandableHashMap<GeoCoord, bool> coordExpanded;    //their cost can't improve any more
 
     while (!coordToExamine.empty())
     {
         GeoCoord curr = coordToExamine.top().second;
         coordToExamine.pop();
-   
+        q.heapPops++;
+
+        //a GeoCoord is pushed again whenever a cheaper way to it turns up, so
+        //skip the stale entries left behind
+        if (coordExpanded.find(curr, q.hashProbes) != nullptr)
+            continue;
+        coordExpanded.associate(curr, true);
+
         //check if we are at our destination
         if (curr == end)
         {
@@ -66,7 +133,7 @@ DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
             vector<StreetSegment> v1, v2;
             for(;;)
             {
-                GeoCoord prev = *locationsOfPreviousWayPoint.find(curr);
+                GeoCoord prev = *locationsOfPreviousWayPoint.find(curr, q.hashProbes);
                 totalDistanceTravelled += distanceEarthMiles(curr, prev);
 
                 //find the street segment that contains both curr and prev
@@ -80,7 +147,7 @@ DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
                     {
                         if (v1[i].start == v2[j].end && v1[i].end == v2[j].start) //street segment found
                         {
-                            output.push_front(v1[i]);
+                            output.push_front(v2[j]);  //the segment from prev to curr
                             strSegFound = true;
                             break;
                         }
@@ -94,32 +161,94 @@ DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
                     break;
             }
             swap(route, output);
+            recordQuery(q, queryStart);
             return DELIVERY_SUCCESS;
         }
+        //reading the clock on every expansion would cost more than the search
+        if (cancel != nullptr && (q.nodesExpanded & 255) == 0 && cancel->isCancelled())
+        {
+            interrupted = true;
+            break;
+        }
         m_streetMap->getSegmentsThatStartWith(curr, v);
+        q.nodesExpanded++;
+        double currCost = *coordVisited.find(curr, q.hashProbes);
 
-        for (int k = 0; k < v.size(); k++)
+        for (size_t k = 0; k < v.size(); k++)
         {
             GeoCoord next = v[k].end;
-            //if we encounter a GeoCoord that we've visited, we'll just ignore it for simplicity
-            if (coordVisited.find(next) != nullptr) 
+            //compute the cost to next, and keep it only if it beats the best so far
+            double cost = currCost + distanceEarthMiles(curr, next);
+            double* ptrToNextCost = coordVisited.find(next, q.hashProbes);
+            if (ptrToNextCost != nullptr && *ptrToNextCost <= cost)
                 continue;
 
-            double* ptrToCurrCost = coordVisited.find(curr);
-            if (ptrToCurrCost != nullptr)
-            {
-                //compute the cost to next
-                double cost = *ptrToCurrCost + distanceEarthMiles(curr, next);
-                coordVisited.associate(next, cost);  //dropping breadcrumbs
-                locationsOfPreviousWayPoint.associate(next, curr);
-                //push next into the priority queue
-                coordToExamine.push(make_pair(cost + distanceEarthMiles(next, end), next));
-            }
+            coordVisited.associate(next, cost);  //dropping breadcrumbs
+            locationsOfPreviousWayPoint.associate(next, curr);
+            //push next into the priority queue
+            coordToExamine.push(make_pair(cost + distanceEarthMiles(next, end), next));
+            q.heapPushes++;
+            q.maxFrontier = max(q.maxFrontier, coordToExamine.size());
         }
     }
+    recordQuery(q, queryStart);
     return NO_ROUTE;
 }
 
+void PointToPointRouterImpl::setStats(PlanStats* stats)
+{
+    m_stats = stats;
+}
+
+void PointToPointRouterImpl::setChainContraction(bool on)
+{
+    m_contractChains = on;
+}
+
+void PointToPointRouterImpl::warmUp() const
+{
+    if (m_contractChains)
+        buildChainGraph();
+}
+
+// The map's intersection graph, built by warmUp or the first search to need
+// it, or nullptr to search the map itself. A search that can be cancelled
+// doesn't wait for it to be built, as that takes far longer than most
+// searches; the first such search builds it on a thread of its own for
+// the searches that come after.
+const ChainGraph* PointToPointRouterImpl::chainGraph(const CancellationToken* cancel) const
+{
+    if (!m_contractChains)
+        return nullptr;
+    if (cancel != nullptr && !m_chainGraphReady)
+    {
+        call_once(m_backgroundStarted, [this]()
+        {
+            m_backgroundBuild = async(launch::async, [this]() { buildChainGraph(); });
+        });
+        return nullptr;
+    }
+    buildChainGraph();
+    return m_chainGraph;
+}
+
+// A tiled map isn't contracted, as that would mean loading every tile.
+void PointToPointRouterImpl::buildChainGraph() const
+{
+    call_once(m_chainGraphBuilt, [this]()
+    {
+        if (m_streetMap->getTileCacheStats().tiles == 0)
+            m_chainGraph = new ChainGraph(*m_streetMap);
+        m_chainGraphReady = true;
+    });
+}
+
+void PointToPointRouterImpl::recordQuery(const RouteQueryStats& q, chrono::steady_clock::time_point queryStart) const
+{
+    if (GOOBEREATS_STATS_ENABLED && m_stats != nullptr)
+        m_stats->recordQuery(q, microsSince(queryStart));
+}
+
 //******************** PointToPointRouter functions ***************************
 
 // These functions simply delegate to PointToPointRouterImpl's functions.
@@ -141,5 +270,32 @@ DeliveryResult PointToPointRouter::generatePointToPointRoute(
     list<StreetSegment>& route,
     double& totalDistanceTravelled) const
 {
-    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
+    bool interrupted;
+    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled, nullptr, interrupted);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointRoute(
+    const GeoCoord& start,
+    const GeoCoord& end,
+    list<StreetSegment>& route,
+    double& totalDistanceTravelled,
+    const CancellationToken& cancel,
+    bool& interrupted) const
+{
+    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled, &cancel, interrupted);
+}
+
+void PointToPointRouter::setStats(PlanStats* stats)
+{
+    m_impl->setStats(stats);
+}
+
+void PointToPointRouter::setChainContraction(bool on)
+{
+    m_impl->setChainContraction(on);
+}
+
+void PointToPointRouter::warmUp() const
+{
+    m_impl->warmUp();
 }
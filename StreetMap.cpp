@@ -1,11 +1,27 @@
 #include "provided.h"
 #include "ExpandableHashMap.h"
 #include <string>
+#include <string_view>
 #include <vector>
 #include <functional>
 #include <fstream>
+#include <sstream>
+#include <iterator>
+#include <memory_resource>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <cmath>
+#include <algorithm>
 using namespace std;
 
+bool parseSegment(const string& line, GeoCoord& B, GeoCoord& E);
+bool splitSegment(string_view line, string_view start[2], string_view end[2]);
+bool nextLine(const string& text, size_t& pos, string_view& line);
+long long tileNumber(double degrees, double tileDegrees);
+string tileKey(long long row, long long col);
+
 unsigned int hasher(const GeoCoord& g)
 {
     return std::hash<std::string>()(g.latitudeText + g.longitudeText);
@@ -16,100 +32,801 @@ unsigned int hasher(const string& str)
     return std::hash<std::string>()(str);
 }
 
-class StreetMapImpl
+// A point's coordinates as the text being loaded spells them.
+struct PointText
+{
+    string_view lat;
+    string_view lon;
+    bool operator==(const PointText& other) const { return lat == other.lat && lon == other.lon; }
+};
+
+struct PointTextHash
+{
+    size_t operator()(const PointText& p) const
+    {
+        return hash<string_view>()(p.lat) * 31 + hash<string_view>()(p.lon);
+    }
+};
+
+// One segment as read, by the numbers of its ends and of its street.
+struct RawSegment
+{
+    size_t from;
+    size_t to;
+    size_t street;
+};
+
+// What a load builds a tile from, all of it in the load's arena: the points
+// numbered as they first appear, the street names, every segment in both
+// directions, and then each point's outgoing segments, listed through
+// firstOut as in a CSR graph. Names and coordinates are views into the text.
+struct LoadGraph
+{
+    LoadGraph(pmr::memory_resource* arena)
+        : pointOf(arena), coords(arena), streets(arena), segs(arena), firstOut(arena), out(arena)
+    {}
+    size_t pointNumber(string_view lat, string_view lon);
+
+    pmr::unordered_map<PointText, size_t, PointTextHash> pointOf;
+    pmr::vector<GeoCoord> coords;
+    pmr::vector<string_view> streets;
+    pmr::vector<RawSegment> segs;
+    pmr::vector<size_t> firstOut;
+    pmr::vector<size_t> out;    //indices into segs
+};
+
+// The segments of the whole map, or of one tile of it: every segment that
+// starts or ends in the tile, in both directions. Once loaded, each point's
+// segments sit back to back in one array, with the points laid out in the
+// order given by the layout, so that nearby points share cache lines.
+class MapTile
 {
 public:
-    StreetMapImpl();
-    ~StreetMapImpl();
-    bool load(string mapFile);
-    bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+    MapTile();
+    void load(istream& in, MapLayout layout);
+    bool find(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+    bool getComponent(const GeoCoord& gc, size_t& component) const;
+    void getCoords(vector<GeoCoord>& coords) const;
+    size_t bytes() const { return m_bytes; }
+    //points are numbered in layout order, and segments as they're stored
+    size_t numPoints() const { return m_firstSegment.empty() ? 0 : m_firstSegment.size() - 1; }
+    bool pointId(const GeoCoord& gc, size_t& id) const;
+    void segmentIds(size_t id, size_t& first, size_t& count) const
+    {
+        first = m_firstSegment[id];
+        count = m_firstSegment[id + 1] - first;
+    }
+    const StreetSegment& segment(size_t k) const { return m_segments[k]; }
+    // C++11 syntax for preventing copying and assignment
+    MapTile(const MapTile&) = delete;
+    MapTile& operator=(const MapTile&) = delete;
 private:
-    ExpandableHashMap <GeoCoord, vector<StreetSegment>> m_hashMap;
-    vector<vector<StreetSegment>*> m_streetSeg;
+    struct NodeSpan
+    {
+        size_t id;      //the point's number, in layout order
+        size_t component;
+    };
+
+    ExpandableHashMap<GeoCoord, NodeSpan> m_nodes;
+    vector<StreetSegment> m_segments;
+    vector<size_t> m_firstSegment;  //of each point by number, then one past the last
+    size_t m_bytes;     //a rough count of the heap we hold
+
+    void layOut(const LoadGraph& g, MapLayout layout);
+    void orderNodes(const LoadGraph& g, MapLayout layout, vector<size_t>& order) const;
+    void labelComponents(const LoadGraph& g, const vector<size_t>& order, vector<size_t>& component) const;
 };
 
-StreetMapImpl::StreetMapImpl()
+const size_t NO_COMPONENT = static_cast<size_t>(-1);
+
+unsigned long long hilbertIndex(unsigned int x, unsigned int y);
+
+MapTile::MapTile()
+    :m_bytes(0)
 {
 }
 
-StreetMapImpl::~StreetMapImpl()
+size_t LoadGraph::pointNumber(string_view lat, string_view lon)
 {
-    for (size_t k = 0; k < m_streetSeg.size(); k++)
-        delete m_streetSeg[k];
+    PointText key = { lat, lon };
+    auto ins = pointOf.try_emplace(key, coords.size());
+    if (ins.second)
+        coords.push_back(GeoCoord(string(lat), string(lon)));
+    return ins.first->second;
 }
 
-bool StreetMapImpl::load(string mapFile)
+// Build the tile in two passes over what was read: number the points and
+// list the segments, then count each point's segments and file them under
+// it, so that every segment is copied into m_segments exactly once. All the
+// scratch space comes from one arena, and is given back in one go.
+void MapTile::load(istream& in, MapLayout layout)
 {
-    ifstream myfile(mapFile);
-    if (myfile.is_open())
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    size_t numLines = count(text.begin(), text.end(), '\n') + 1;
+    pmr::monotonic_buffer_resource arena;
+    LoadGraph g(&arena);
+    g.pointOf.reserve(numLines);
+    g.coords.reserve(numLines);
+    g.segs.reserve(m_segments.size() + 2 * numLines);
+
+    //first pass: starting from whatever an earlier load left, which the views
+    //point into until layOut replaces it
+    for (size_t k = 0; k < m_segments.size(); k++)
+        g.pointNumber(m_segments[k].start.latitudeText, m_segments[k].start.longitudeText);
+    for (size_t k = 0; k < m_segments.size(); k++)
+    {
+        const StreetSegment& seg = m_segments[k];
+        g.streets.push_back(seg.name);
+        RawSegment s = { g.pointNumber(seg.start.latitudeText, seg.start.longitudeText),
+            g.pointNumber(seg.end.latitudeText, seg.end.longitudeText), g.streets.size() - 1 };
+        g.segs.push_back(s);
+    }
+
+    size_t pos = 0;
+    string_view line;
+    int numSegmentsLeft = 0;
+    while (nextLine(text, pos, line))
     {
-        string line;
-        string streetName;
-        int numSegmentsLeft = 0;
-        while(getline(myfile, line))
+        if (numSegmentsLeft > 0)
         {
-            if (numSegmentsLeft > 0)
+            //process the current streetSegment, and its reverse
+            string_view B[2], E[2];     //starting and ending coordinates
+            if (splitSegment(line, B, E))
             {
-                //process the current streetSegment
-                int space_1_index = line.find(' ');
-                string startLat = line.substr(0, space_1_index);
-                int space_2_index = line.find(' ', space_1_index + 1);
-                string startLong = line.substr(space_1_index + 1, space_2_index - space_1_index - 1);
-                GeoCoord B(startLat, startLong);    //starting coordinate
-
-                int space_3_index = line.find(' ', space_2_index + 1);
-                string endLat = line.substr(space_2_index + 1, space_3_index - space_2_index - 1);
-                string endLong = line.substr(space_3_index + 1, line.size() - space_3_index - 1);
-                GeoCoord E(endLat, endLong);    //ending coordinate
-
-                vector<StreetSegment>* ptrToStrSeg = m_hashMap.find(B);
-                StreetSegment S(B, E, streetName);
-                if (ptrToStrSeg != nullptr)
-                    ptrToStrSeg->push_back(S);
-                else
+                size_t from = g.pointNumber(B[0], B[1]);
+                size_t to = g.pointNumber(E[0], E[1]);
+                RawSegment s = { from, to, g.streets.size() - 1 };
+                RawSegment reverse = { to, from, g.streets.size() - 1 };
+                g.segs.push_back(s);
+                g.segs.push_back(reverse);
+            }
+            numSegmentsLeft--;
+        }
+        else
+        {
+            g.streets.push_back(line);
+            if (!nextLine(text, pos, line))
+                break;
+            numSegmentsLeft = stoi(string(line));
+        }
+    }
+
+    //second pass: count each point's segments, then file them under it in
+    //the order they were read
+    size_t numPoints = g.coords.size();
+    g.firstOut.assign(numPoints + 1, 0);
+    for (size_t k = 0; k < g.segs.size(); k++)
+        g.firstOut[g.segs[k].from + 1]++;
+    for (size_t p = 0; p < numPoints; p++)
+        g.firstOut[p + 1] += g.firstOut[p];
+    pmr::vector<size_t> next(g.firstOut.begin(), g.firstOut.end() - 1, &arena);
+    g.out.resize(g.segs.size());
+    for (size_t k = 0; k < g.segs.size(); k++)
+        g.out[next[g.segs[k].from]++] = k;
+
+    layOut(g, layout);
+}
+
+// Fill m_segments, point after point in layout order, and index them by
+// point.
+void MapTile::layOut(const LoadGraph& g, MapLayout layout)
+{
+    vector<size_t> order;
+    orderNodes(g, layout, order);
+    vector<size_t> component;
+    labelComponents(g, order, component);
+
+    vector<StreetSegment> segments;
+    segments.reserve(g.segs.size());
+    m_nodes.reset();
+    m_nodes.reserve(order.size());
+    m_firstSegment.clear();
+    m_firstSegment.reserve(order.size() + 1);
+    m_bytes = 0;
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        size_t p = order[k];
+        NodeSpan span = { k, component[p] };
+        m_nodes.associate(g.coords[p], span);
+        m_firstSegment.push_back(segments.size());
+        //the key, its bucket node and list links, and its first segment
+        m_bytes += sizeof(GeoCoord) + sizeof(NodeSpan) + 3 * sizeof(void*) + sizeof(size_t);
+        for (size_t i = g.firstOut[p]; i < g.firstOut[p + 1]; i++)
+        {
+            const RawSegment& s = g.segs[g.out[i]];
+            segments.emplace_back();
+            StreetSegment& seg = segments.back();
+            seg.start = g.coords[s.from];
+            seg.end = g.coords[s.to];
+            seg.name.assign(g.streets[s.street]);
+            m_bytes += sizeof(StreetSegment) + (seg.name.size() > 15 ? seg.name.size() + 1 : 0);
+        }
+    }
+    m_firstSegment.push_back(segments.size());
+    swap(m_segments, segments);
+}
+
+// Number the connected pieces of the map, in layout order. Every street is
+// stored in both directions, so these are also its strongly connected
+// components.
+void MapTile::labelComponents(const LoadGraph& g, const vector<size_t>& order, vector<size_t>& component) const
+{
+    component.assign(g.coords.size(), NO_COMPONENT);
+    size_t numComponents = 0;
+    vector<size_t> toVisit;
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        if (component[order[k]] != NO_COMPONENT)
+            continue;
+        component[order[k]] = numComponents;
+        toVisit.push_back(order[k]);
+        while (!toVisit.empty())
+        {
+            size_t curr = toVisit.back();
+            toVisit.pop_back();
+            for (size_t i = g.firstOut[curr]; i < g.firstOut[curr + 1]; i++)
+            {
+                size_t next = g.segs[g.out[i]].to;
+                if (component[next] == NO_COMPONENT)
                 {
-                    vector<StreetSegment>* strSeg_B = new vector<StreetSegment>;
-                    strSeg_B->push_back(S);
-                    m_hashMap.associate(B, *strSeg_B);
-                    m_streetSeg.push_back(strSeg_B);
+                    component[next] = numComponents;
+                    toVisit.push_back(next);
                 }
+            }
+        }
+        numComponents++;
+    }
+}
 
-                //the reverse street segment
-                ptrToStrSeg = m_hashMap.find(E);
-                StreetSegment R(E, B, streetName);
-                if (ptrToStrSeg != nullptr)
-                    ptrToStrSeg->push_back(R);
-                else
+void MapTile::orderNodes(const LoadGraph& g, MapLayout layout, vector<size_t>& order) const
+{
+    const pmr::vector<GeoCoord>& coords = g.coords;
+    order.clear();
+    order.reserve(coords.size());
+    if (layout == LAYOUT_HILBERT && !coords.empty())
+    {
+        //scale the bounding box onto a 65536 x 65536 grid and sort the points
+        //by where the Hilbert curve passes through their cell
+        double minLat = coords[0].latitude, maxLat = minLat;
+        double minLon = coords[0].longitude, maxLon = minLon;
+        for (size_t k = 1; k < coords.size(); k++)
+        {
+            minLat = min(minLat, coords[k].latitude);
+            maxLat = max(maxLat, coords[k].latitude);
+            minLon = min(minLon, coords[k].longitude);
+            maxLon = max(maxLon, coords[k].longitude);
+        }
+        double latScale = (maxLat > minLat ? 65535 / (maxLat - minLat) : 0);
+        double lonScale = (maxLon > minLon ? 65535 / (maxLon - minLon) : 0);
+        vector<pair<unsigned long long, size_t>> keyed;
+        keyed.reserve(coords.size());
+        for (size_t k = 0; k < coords.size(); k++)
+        {
+            unsigned int x = static_cast<unsigned int>((coords[k].longitude - minLon) * lonScale);
+            unsigned int y = static_cast<unsigned int>((coords[k].latitude - minLat) * latScale);
+            keyed.push_back(make_pair(hilbertIndex(x, y), k));
+        }
+        sort(keyed.begin(), keyed.end());
+        for (size_t k = 0; k < keyed.size(); k++)
+            order.push_back(keyed[k].second);
+    }
+    else if (layout == LAYOUT_BFS)
+    {
+        //breadth first from each point not reached yet, in file order
+        vector<bool> reached(coords.size(), false);
+        for (size_t root = 0; root < coords.size(); root++)
+        {
+            if (reached[root])
+                continue;
+            reached[root] = true;
+            size_t head = order.size();
+            order.push_back(root);
+            for (; head < order.size(); head++)
+            {
+                size_t curr = order[head];
+                for (size_t i = g.firstOut[curr]; i < g.firstOut[curr + 1]; i++)
                 {
-                    vector<StreetSegment>* strSeg_E = new vector<StreetSegment>;
-                    strSeg_E->push_back(R);
-                    m_hashMap.associate(E, *strSeg_E);
-                    m_streetSeg.push_back(strSeg_E);
+                    size_t next = g.segs[g.out[i]].to;
+                    if (!reached[next])
+                    {
+                        reached[next] = true;
+                        order.push_back(next);
+                    }
                 }
-                numSegmentsLeft--;
             }
-            else
+        }
+    }
+    else
+    {
+        for (size_t k = 0; k < coords.size(); k++)
+            order.push_back(k);
+    }
+}
+
+bool MapTile::find(const GeoCoord& gc, vector<StreetSegment>& segs) const
+{
+    const NodeSpan* span = m_nodes.find(gc);
+    if (span == nullptr)
+        return false;
+    segs.assign(m_segments.begin() + m_firstSegment[span->id], m_segments.begin() + m_firstSegment[span->id + 1]);
+    return true;
+}
+
+bool MapTile::pointId(const GeoCoord& gc, size_t& id) const
+{
+    const NodeSpan* span = m_nodes.find(gc);
+    if (span == nullptr)
+        return false;
+    id = span->id;
+    return true;
+}
+
+bool MapTile::getComponent(const GeoCoord& gc, size_t& component) const
+{
+    const NodeSpan* span = m_nodes.find(gc);
+    if (span == nullptr)
+        return false;
+    component = span->component;
+    return true;
+}
+
+void MapTile::getCoords(vector<GeoCoord>& coords) const
+{
+    //a point's segments all start at it, and each point's run starts afresh
+    for (size_t k = 0; k < m_segments.size(); k++)
+    {
+        if (k == 0 || m_segments[k].start != m_segments[k - 1].start)
+            coords.push_back(m_segments[k].start);
+    }
+}
+
+// The distance along the Hilbert curve through a 65536 x 65536 grid to the
+// cell x, y.
+unsigned long long hilbertIndex(unsigned int x, unsigned int y)
+{
+    unsigned long long d = 0;
+    for (unsigned int s = 1u << 15; s > 0; s /= 2)
+    {
+        unsigned int rx = (x & s) ? 1 : 0;
+        unsigned int ry = (y & s) ? 1 : 0;
+        d += static_cast<unsigned long long>(s) * s * ((3 * rx) ^ ry);
+        //rotate the quadrant so the curve inside it joins up
+        if (ry == 0)
+        {
+            if (rx == 1)
             {
-                streetName = line;
-                getline(myfile, line);
-                numSegmentsLeft = stoi(line);
+                x = s - 1 - x;
+                y = s - 1 - y;
             }
+            swap(x, y);
         }
-        myfile.close();
-        return true;
     }
-    return false;
+    return d;
+}
+
+class StreetMapImpl
+{
+public:
+    StreetMapImpl();
+    bool load(string mapFile);
+    bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+    void getAllCoords(vector<GeoCoord>& coords) const;
+    void setTileMemoryLimit(size_t bytes);
+    TileCacheStats getTileCacheStats() const;
+    void setLayout(MapLayout layout);
+    bool getComponent(const GeoCoord& gc, size_t& component) const;
+    size_t getNumPoints() const;
+    bool getPointId(const GeoCoord& gc, size_t& id) const;
+    void getSegmentIds(size_t pointId, size_t& first, size_t& count) const;
+    const StreetSegment& getSegment(size_t segmentId) const;
+private:
+    struct TileSlot
+    {
+        long long row;
+        long long col;
+        string file;
+        shared_ptr<const MapTile> tile;     //nullptr until a query touches it, and once evicted
+        bool loading;       //a query is reading the tile's file
+        unsigned long long lastUsed;
+    };
+
+    MapLayout m_layout;
+    MapTile m_whole;    //a map loaded from one file
+    //a tiled map
+    double m_tileDegrees;   //0 until a tile index is loaded
+    mutable vector<TileSlot> m_tiles;
+    ExpandableHashMap<string, size_t> m_tileIndex;
+    size_t m_memoryLimit;
+    mutable mutex m_tileMutex;  //guards the slots and counters below
+    mutable condition_variable m_tileLoaded;    //a slot has stopped loading
+    mutable unsigned long long m_clock;
+    mutable size_t m_loadedBytes;
+    mutable size_t m_tileLoads;
+    mutable size_t m_tileEvictions;
+    mutable size_t m_tileLoadFailures;
+
+    bool loadTileIndex(istream& index, string dir);
+    shared_ptr<const MapTile> tileFor(const GeoCoord& gc) const;
+    shared_ptr<const MapTile> loadTile(size_t slot) const;
+    void evictTiles(size_t keep) const;
+};
+
+StreetMapImpl::StreetMapImpl()
+    :m_layout(LAYOUT_HILBERT), m_tileDegrees(0), m_memoryLimit(0), m_clock(0), m_loadedBytes(0), m_tileLoads(0),
+    m_tileEvictions(0), m_tileLoadFailures(0)
+{
+}
+
+bool StreetMapImpl::load(string mapFile)
+{
+    ifstream myfile(mapFile);
+    if (!myfile.is_open())
+        return false;
+
+    //a tile index starts with "#tiles", anything else is a whole map
+    string line;
+    if (getline(myfile, line) && line.compare(0, 7, "#tiles ") == 0)
+    {
+        size_t slash = mapFile.rfind('/');
+        string dir = (slash == string::npos ? "" : mapFile.substr(0, slash + 1));
+        m_tileDegrees = stod(line.substr(7));
+        return loadTileIndex(myfile, dir);
+    }
+    myfile.clear();
+    myfile.seekg(0);
+    m_whole.load(myfile, m_layout);
+    return true;
+}
+
+bool StreetMapImpl::loadTileIndex(istream& index, string dir)
+{
+    if (!(m_tileDegrees > 0))
+        return false;
+    string line;
+    while (getline(index, line))
+    {
+        TileSlot slot;
+        istringstream iss(line);
+        if (!(iss >> slot.row >> slot.col >> slot.file))
+            continue;
+        slot.file = dir + slot.file;
+        slot.tile = nullptr;
+        slot.loading = false;
+        slot.lastUsed = 0;
+        m_tileIndex.associate(tileKey(slot.row, slot.col), m_tiles.size());
+        m_tiles.push_back(slot);
+    }
+    return true;
 }
 
 bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
-    const vector<StreetSegment>* ptrToStrSeg = m_hashMap.find(gc);
-    if (ptrToStrSeg == nullptr)
+    if (m_tileDegrees == 0)
+    {
+        return m_whole.find(gc, segs);
+    }
+
+    //the query holds on to the tile, so another can evict it meanwhile
+    shared_ptr<const MapTile> tile = tileFor(gc);
+    return tile != nullptr && tile->find(gc, segs);
+}
+
+void StreetMapImpl::getAllCoords(vector<GeoCoord>& coords) const
+{
+    coords.clear();
+    if (m_tileDegrees == 0)
+    {
+        m_whole.getCoords(coords);
+        return;
+    }
+
+    //a tile also holds the far ends of segments that leave it; those belong
+    //to the tile next door
+    vector<GeoCoord> tileCoords;
+    for (size_t k = 0; k < m_tiles.size(); k++)
+    {
+        shared_ptr<const MapTile> tile = loadTile(k);
+        if (tile == nullptr)
+            continue;
+        tileCoords.clear();
+        tile->getCoords(tileCoords);
+        for (size_t i = 0; i < tileCoords.size(); i++)
+        {
+            if (tileNumber(tileCoords[i].latitude, m_tileDegrees) == m_tiles[k].row &&
+                tileNumber(tileCoords[i].longitude, m_tileDegrees) == m_tiles[k].col)
+                coords.push_back(tileCoords[i]);
+        }
+    }
+}
+
+void StreetMapImpl::setTileMemoryLimit(size_t bytes)
+{
+    lock_guard<mutex> lock(m_tileMutex);
+    m_memoryLimit = bytes;
+    evictTiles(m_tiles.size());
+}
+
+bool StreetMapImpl::getComponent(const GeoCoord& gc, size_t& component) const
+{
+    //a tile only sees its own part of the map, so can't tell what joins up
+    if (m_tileDegrees != 0)
+        return false;
+    return m_whole.getComponent(gc, component);
+}
+
+//a tiled map's points are spread over tiles that come and go, so only a
+//whole map numbers them
+size_t StreetMapImpl::getNumPoints() const
+{
+    return m_tileDegrees == 0 ? m_whole.numPoints() : 0;
+}
+
+bool StreetMapImpl::getPointId(const GeoCoord& gc, size_t& id) const
+{
+    return m_tileDegrees == 0 && m_whole.pointId(gc, id);
+}
+
+void StreetMapImpl::getSegmentIds(size_t pointId, size_t& first, size_t& count) const
+{
+    m_whole.segmentIds(pointId, first, count);
+}
+
+const StreetSegment& StreetMapImpl::getSegment(size_t segmentId) const
+{
+    return m_whole.segment(segmentId);
+}
+
+void StreetMapImpl::setLayout(MapLayout layout)
+{
+    lock_guard<mutex> lock(m_tileMutex);
+    m_layout = layout;
+}
+
+TileCacheStats StreetMapImpl::getTileCacheStats() const
+{
+    lock_guard<mutex> lock(m_tileMutex);
+    TileCacheStats stats;
+    stats.tiles = m_tiles.size();
+    for (size_t k = 0; k < m_tiles.size(); k++)
+    {
+        if (m_tiles[k].tile != nullptr)
+            stats.loadedTiles++;
+    }
+    stats.loadedBytes = m_loadedBytes;
+    stats.loads = m_tileLoads;
+    stats.evictions = m_tileEvictions;
+    stats.failedLoads = m_tileLoadFailures;
+    return stats;
+}
+
+// The tile gc lies in, loading it if need be, or nullptr if the map has no
+// such tile or it won't load.
+shared_ptr<const MapTile> StreetMapImpl::tileFor(const GeoCoord& gc) const
+{
+    const size_t* ptrToSlot = m_tileIndex.find(tileKey(tileNumber(gc.latitude, m_tileDegrees),
+        tileNumber(gc.longitude, m_tileDegrees)));
+    if (ptrToSlot == nullptr)
+        return nullptr;
+    return loadTile(*ptrToSlot);
+}
+
+// The tile in slot, or nullptr if its file won't open or read. The file is
+// read without holding m_tileMutex, so queries for loaded tiles go on
+// meanwhile; queries for this one wait for it rather than reading it too.
+shared_ptr<const MapTile> StreetMapImpl::loadTile(size_t slot) const
+{
+    unique_lock<mutex> lock(m_tileMutex);
+    TileSlot& ts = m_tiles[slot];
+    ts.lastUsed = ++m_clock;
+    m_tileLoaded.wait(lock, [&ts]() { return !ts.loading; });
+    if (ts.tile != nullptr)
+        return ts.tile;
+    ts.loading = true;
+    MapLayout layout = m_layout;
+    lock.unlock();
+
+    shared_ptr<MapTile> tile;
+    ifstream tileFile(ts.file);
+    if (tileFile.is_open())
+    {
+        try
+        {
+            tile = make_shared<MapTile>();
+            tile->load(tileFile, layout);
+        }
+        catch (const exception&)
+        {
+            tile = nullptr;
+        }
+    }
+
+    lock.lock();
+    ts.loading = false;
+    m_tileLoaded.notify_all();
+    //a tile that won't load isn't cached, so the next query tries it again
+    if (tile == nullptr)
+    {
+        m_tileLoadFailures++;
+        return nullptr;
+    }
+    ts.tile = tile;
+    m_loadedBytes += tile->bytes();
+    m_tileLoads++;
+    evictTiles(slot);
+    return ts.tile;
+}
+
+// Unload the least recently used tiles, other than keep, until the loaded
+// ones fit under the memory limit. A query still using an unloaded tile
+// keeps it until it's done. The caller holds m_tileMutex.
+void StreetMapImpl::evictTiles(size_t keep) const
+{
+    while (m_memoryLimit != 0 && m_loadedBytes > m_memoryLimit)
+    {
+        size_t coldest = m_tiles.size();
+        for (size_t k = 0; k < m_tiles.size(); k++)
+        {
+            if (k != keep && m_tiles[k].tile != nullptr &&
+                (coldest == m_tiles.size() || m_tiles[k].lastUsed < m_tiles[coldest].lastUsed))
+                coldest = k;
+        }
+        if (coldest == m_tiles.size())
+            return;     //only keep is left
+        m_loadedBytes -= m_tiles[coldest].tile->bytes();
+        m_tiles[coldest].tile = nullptr;
+        m_tileEvictions++;
+    }
+}
+
+bool parseSegment(const string& line, GeoCoord& B, GeoCoord& E)
+{
+    string_view start[2], end[2];
+    if (!splitSegment(line, start, end))
+        return false;
+    B = GeoCoord(string(start[0]), string(start[1]));
+    E = GeoCoord(string(end[0]), string(end[1]));
+    return true;
+}
+
+// The latitude and longitude texts of a segment line's two ends.
+bool splitSegment(string_view line, string_view start[2], string_view end[2])
+{
+    size_t space_1_index = line.find(' ');
+    size_t space_2_index = line.find(' ', space_1_index + 1);
+    size_t space_3_index = line.find(' ', space_2_index + 1);
+    if (space_1_index == string_view::npos || space_2_index == string_view::npos ||
+        space_3_index == string_view::npos)
         return false;
-    segs = *ptrToStrSeg;
+    start[0] = line.substr(0, space_1_index);
+    start[1] = line.substr(space_1_index + 1, space_2_index - space_1_index - 1);
+    end[0] = line.substr(space_2_index + 1, space_3_index - space_2_index - 1);
+    end[1] = line.substr(space_3_index + 1);
     return true;
 }
 
+// Like getline, over text already read, moving pos past the line.
+bool nextLine(const string& text, size_t& pos, string_view& line)
+{
+    if (pos >= text.size())
+        return false;
+    size_t newline = text.find('\n', pos);
+    if (newline == string::npos)
+        newline = text.size();
+    line = string_view(text).substr(pos, newline - pos);
+    pos = newline + 1;
+    return true;
+}
+
+// Tiles are numbered by how many whole tiles a point lies north or east of
+// 0,0, so a point's tile depends only on its own coordinates.
+long long tileNumber(double degrees, double tileDegrees)
+{
+    return static_cast<long long>(floor(degrees / tileDegrees));
+}
+
+string tileKey(long long row, long long col)
+{
+    return to_string(row) + " " + to_string(col);
+}
+
+bool splitMapIntoTiles(const string& mapFile, const string& indexFile, double tileDegrees)
+{
+    ifstream myfile(mapFile);
+    if (!myfile.is_open() || !(tileDegrees > 0))
+        return false;
+
+    //the text of each tile, and of the street being split into them
+    struct TileText
+    {
+        long long row;
+        long long col;
+        string text;
+        string street;
+        int numStreetSegments;
+    };
+    vector<TileText> tiles;
+    ExpandableHashMap<string, size_t> tileIndex;
+    vector<size_t> streetTiles;     //the tiles the current street reaches
+
+    string line;
+    string streetName;
+    int numSegmentsLeft = 0;
+    while (getline(myfile, line))
+    {
+        if (numSegmentsLeft == 0)
+        {
+            streetName = line;
+            getline(myfile, line);
+            numSegmentsLeft = stoi(line);
+            streetTiles.clear();
+        }
+        else
+        {
+            GeoCoord B, E;
+            if (!parseSegment(line, B, E))
+                return false;
+            //the segment goes to the tiles of both its ends, so each tile
+            //knows every segment leaving each of its own points
+            GeoCoord ends[2] = { B, E };
+            size_t prevTile = static_cast<size_t>(-1);
+            for (int e = 0; e < 2; e++)
+            {
+                long long row = tileNumber(ends[e].latitude, tileDegrees);
+                long long col = tileNumber(ends[e].longitude, tileDegrees);
+                string key = tileKey(row, col);
+                size_t* ptrToTile = tileIndex.find(key);
+                size_t t;
+                if (ptrToTile != nullptr)
+                    t = *ptrToTile;
+                else
+                {
+                    t = tiles.size();
+                    tileIndex.associate(key, t);
+                    tiles.push_back(TileText{ row, col, "", "", 0 });
+                }
+                if (t == prevTile)
+                    break;
+                if (tiles[t].numStreetSegments == 0)
+                    streetTiles.push_back(t);
+                tiles[t].street += line + "\n";
+                tiles[t].numStreetSegments++;
+                prevTile = t;
+            }
+            numSegmentsLeft--;
+        }
+
+        if (numSegmentsLeft == 0)
+        {
+            for (size_t k = 0; k < streetTiles.size(); k++)
+            {
+                TileText& tt = tiles[streetTiles[k]];
+                tt.text += streetName + "\n" + to_string(tt.numStreetSegments) + "\n" + tt.street;
+                tt.street.clear();
+                tt.numStreetSegments = 0;
+            }
+            streetTiles.clear();
+        }
+    }
+
+    //tile files sit next to the index, which names them relative to itself
+    size_t slash = indexFile.rfind('/');
+    string dir = (slash == string::npos ? "" : indexFile.substr(0, slash + 1));
+    string base = indexFile.substr(dir.size());
+    ofstream index(indexFile);
+    index.precision(17);
+    index << "#tiles " << tileDegrees << "\n";
+    for (size_t k = 0; k < tiles.size(); k++)
+    {
+        string name = base + "." + to_string(tiles[k].row) + "_" + to_string(tiles[k].col) + ".txt";
+        ofstream tileFile(dir + name);
+        tileFile << tiles[k].text;
+        if (!tileFile)
+            return false;
+        index << tiles[k].row << " " << tiles[k].col << " " << name << "\n";
+    }
+    return static_cast<bool>(index);
+}
+
 //******************** StreetMap functions ************************************
 
 // These functions simply delegate to StreetMapImpl's functions.
@@ -134,3 +851,48 @@ bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegmen
 {
     return m_impl->getSegmentsThatStartWith(gc, segs);
 }
+
+void StreetMap::getAllCoords(vector<GeoCoord>& coords) const
+{
+    m_impl->getAllCoords(coords);
+}
+
+void StreetMap::setTileMemoryLimit(size_t bytes)
+{
+    m_impl->setTileMemoryLimit(bytes);
+}
+
+TileCacheStats StreetMap::getTileCacheStats() const
+{
+    return m_impl->getTileCacheStats();
+}
+
+void StreetMap::setLayout(MapLayout layout)
+{
+    m_impl->setLayout(layout);
+}
+
+bool StreetMap::getComponent(const GeoCoord& gc, size_t& component) const
+{
+    return m_impl->getComponent(gc, component);
+}
+
+size_t StreetMap::getNumPoints() const
+{
+    return m_impl->getNumPoints();
+}
+
+bool StreetMap::getPointId(const GeoCoord& gc, size_t& id) const
+{
+    return m_impl->getPointId(gc, id);
+}
+
+void StreetMap::getSegmentIds(size_t pointId, size_t& first, size_t& count) const
+{
+    m_impl->getSegmentIds(pointId, first, count);
+}
+
+const StreetSegment& StreetMap::getSegment(size_t segmentId) const
+{
+    return m_impl->getSegment(segmentId);
+}
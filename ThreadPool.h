@@ -0,0 +1,145 @@
+// ThreadPool.h
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <chrono>
+
+class ThreadPool
+{
+public:
+    ThreadPool(unsigned int numThreads = 0);
+    ~ThreadPool();
+
+    // queue a task and return a future for its result
+    template<typename F>
+    auto submit(F task) -> std::future<decltype(task())>;
+
+    // wait for a future that submit returned, running queued tasks on the
+    // calling thread in the meantime so that tasks may themselves submit and
+    // wait on subtasks
+    template<typename T>
+    T get(std::future<T>& result);
+
+    // C++11 syntax for preventing copying and assignment
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+private:
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;       //a task was queued, or the pool is stopping
+    std::condition_variable m_changed;  //a task was queued or finished, for get
+    size_t m_numGetting;                //threads sleeping in get
+    bool m_stopping;
+
+    void taskFinished();
+};
+
+inline ThreadPool::ThreadPool(unsigned int numThreads)
+    : m_numGetting(0), m_stopping(false)
+{
+    if (numThreads == 0)
+        numThreads = std::thread::hardware_concurrency();
+    if (numThreads == 0)
+        numThreads = 1;
+    for (unsigned int k = 0; k < numThreads; k++)
+    {
+        m_workers.emplace_back([this]()
+        {
+            for (;;)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cv.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+                    if (m_tasks.empty())
+                        return;     //stopping and nothing left to do
+                    task = std::move(m_tasks.front());
+                    m_tasks.pop_front();
+                }
+                task();
+            }
+        });
+    }
+}
+
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    for (size_t k = 0; k < m_workers.size(); k++)
+        m_workers[k].join();
+}
+
+template<typename F>
+auto ThreadPool::submit(F task) -> std::future<decltype(task())>
+{
+    typedef decltype(task()) ResultType;
+    auto packaged = std::make_shared<std::packaged_task<ResultType()>>(std::move(task));
+    std::future<ResultType> result = packaged->get_future();
+    bool wakeGetters;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.emplace_back([this, packaged]()
+        {
+            (*packaged)();
+            taskFinished();
+        });
+        wakeGetters = (m_numGetting > 0);
+    }
+    m_cv.notify_one();
+    if (wakeGetters)
+        m_changed.notify_all();
+    return result;
+}
+
+template<typename T>
+T ThreadPool::get(std::future<T>& result)
+{
+    auto ready = [&result]() { return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready; };
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            //sleep until there's a task to help with, or one has finished,
+            //which might be ours; a task makes its result ready before it
+            //takes the lock to say it has finished, so no wakeup is missed
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_numGetting++;
+            m_changed.wait(lock, [this, &ready]() { return !m_tasks.empty() || ready(); });
+            m_numGetting--;
+            if (ready())
+                break;
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+    return result.get();
+}
+
+inline void ThreadPool::taskFinished()
+{
+    bool wakeGetters;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        wakeGetters = (m_numGetting > 0);
+    }
+    if (wakeGetters)
+        m_changed.notify_all();
+}
+
+#endif // !THREADPOOL_H
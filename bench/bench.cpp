@@ -0,0 +1,402 @@
+// Component micro-benchmarks.
+//
+// Usage: bench [mapdata.txt] [-json results.json] [-queries N] [-seed S]
+//
+// Prints a table of latency percentiles, allocations and, where the kernel
+// exposes hardware counters, cache misses per operation for map loading,
+// ExpandableHashMap, PointToPointRouter over each map layout and
+// DeliveryOptimizer.
+// With -json, also writes one JSON object per benchmark per line, so runs
+// can be compared with a script.
+
+#include "provided.h"
+#include "ExpandableHashMap.h"
+#include "ChainGraph.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+//******************** allocation counting ************************************
+
+atomic<size_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+//******************** cache miss counting ************************************
+
+// Counts this thread's last level cache misses in user space, or reads -1
+// where there are no hardware counters to be had (most VMs and containers).
+class CacheMissCounter
+{
+public:
+    CacheMissCounter()
+        : m_fd(-1)
+    {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#ifdef __linux__
+        if (m_fd >= 0)
+            close(m_fd);
+#endif
+    }
+
+    long long read() const
+    {
+        long long count = -1;
+#ifdef __linux__
+        if (m_fd >= 0 && ::read(m_fd, &count, sizeof(count)) != sizeof(count))
+            count = -1;
+#endif
+        return count;
+    }
+
+    CacheMissCounter(const CacheMissCounter&) = delete;
+    CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+
+private:
+    int m_fd;
+};
+
+CacheMissCounter cacheMisses;
+
+//******************** measurement ********************************************
+
+struct BenchResult
+{
+    string name;
+    vector<double> nanos;       // one sample per timed batch
+    size_t opsPerSample;
+    size_t allocations;         // over all samples
+    long long cacheMisses;      // over all samples, -1 if unknown
+    string note;
+};
+
+// Time op() numSamples times, each sample running it opsPerSample times.
+template<typename Op>
+BenchResult measure(string name, size_t numSamples, size_t opsPerSample, Op op)
+{
+    BenchResult res;
+    res.name = name;
+    res.opsPerSample = opsPerSample;
+    res.nanos.reserve(numSamples);
+    size_t allocsBefore = allocationCount.load();
+    long long missesBefore = cacheMisses.read();
+    for (size_t s = 0; s < numSamples; s++)
+    {
+        auto start = chrono::steady_clock::now();
+        for (size_t k = 0; k < opsPerSample; k++)
+            op(s * opsPerSample + k);
+        res.nanos.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count());
+    }
+    res.allocations = allocationCount.load() - allocsBefore;
+    res.cacheMisses = (missesBefore < 0 ? -1 : cacheMisses.read() - missesBefore);
+    return res;
+}
+
+double percentile(vector<double> samples, double p)
+{
+    if (samples.empty())
+        return 0;
+    sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(p / 100 * samples.size() + 0.999999);
+    return samples[min(max(rank, size_t(1)), samples.size()) - 1];
+}
+
+void report(const BenchResult& res, ostream* json)
+{
+    //per-operation times, in microseconds
+    vector<double> perOp;
+    double total = 0;
+    for (size_t k = 0; k < res.nanos.size(); k++)
+    {
+        perOp.push_back(res.nanos[k] / res.opsPerSample / 1000);
+        total += res.nanos[k];
+    }
+    size_t ops = res.nanos.size() * res.opsPerSample;
+    double opsPerSec = (total > 0 ? ops / (total / 1e9) : 0);
+    double allocsPerOp = (ops > 0 ? static_cast<double>(res.allocations) / ops : 0);
+    double missesPerOp = (ops > 0 && res.cacheMisses >= 0 ? static_cast<double>(res.cacheMisses) / ops : -1);
+
+    cout.setf(ios::fixed);
+    cout.precision(2);
+    cout << res.name << ": p50 " << percentile(perOp, 50) << " us, p90 " << percentile(perOp, 90)
+        << " us, p99 " << percentile(perOp, 99) << " us, max " << percentile(perOp, 100)
+        << " us, " << opsPerSec << " ops/s, " << allocsPerOp << " allocs/op";
+    if (missesPerOp >= 0)
+        cout << ", " << missesPerOp << " cache misses/op";
+    if (!res.note.empty())
+        cout << " (" << res.note << ")";
+    cout << endl;
+
+    if (json != nullptr)
+    {
+        *json << "{\"name\":\"" << res.name << "\",\"ops\":" << ops
+            << ",\"p50_us\":" << percentile(perOp, 50) << ",\"p90_us\":" << percentile(perOp, 90)
+            << ",\"p99_us\":" << percentile(perOp, 99) << ",\"max_us\":" << percentile(perOp, 100)
+            << ",\"ops_per_sec\":" << opsPerSec << ",\"allocs_per_op\":" << allocsPerOp;
+        if (missesPerOp >= 0)
+            *json << ",\"cache_misses_per_op\":" << missesPerOp;
+        *json << ",\"note\":\"" << res.note << "\"}\n";
+    }
+}
+
+//******************** benchmarks *********************************************
+
+// every distinct coordinate that starts or ends a segment in the map file
+bool loadNodes(const string& mapFile, vector<GeoCoord>& nodes)
+{
+    ifstream inf(mapFile);
+    if (!inf)
+        return false;
+    ExpandableHashMap<GeoCoord, bool> seen;
+    string line;
+    while (getline(inf, line))
+    {
+        getline(inf, line);
+        int numSegments = stoi(line);
+        for (int k = 0; k < numSegments && getline(inf, line); k++)
+        {
+            istringstream iss(line);
+            string lat1, lon1, lat2, lon2;
+            iss >> lat1 >> lon1 >> lat2 >> lon2;
+            GeoCoord ends[2] = { GeoCoord(lat1, lon1), GeoCoord(lat2, lon2) };
+            for (int e = 0; e < 2; e++)
+            {
+                if (seen.find(ends[e]) == nullptr)
+                {
+                    seen.associate(ends[e], true);
+                    nodes.push_back(ends[e]);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    string mapFile = "mapdata.txt";
+    string jsonFile;
+    size_t numQueries = 1000;
+    unsigned int seed = 42;
+    for (int k = 1; k < argc; k++)
+    {
+        string arg = argv[k];
+        if (arg == "-json" && k + 1 < argc)
+            jsonFile = argv[++k];
+        else if (arg == "-queries" && k + 1 < argc)
+            numQueries = stoul(argv[++k]);
+        else if (arg == "-seed" && k + 1 < argc)
+            seed = stoul(argv[++k]);
+        else if (arg[0] != '-')
+            mapFile = arg;
+        else
+        {
+            cout << "Usage: " << argv[0] << " [mapdata.txt] [-json results.json] [-queries N] [-seed S]" << endl;
+            return 1;
+        }
+    }
+
+    vector<GeoCoord> nodes;
+    if (!loadNodes(mapFile, nodes) || nodes.empty())
+    {
+        cout << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    ofstream jsonOut;
+    ostream* json = nullptr;
+    if (!jsonFile.empty())
+    {
+        jsonOut.open(jsonFile);
+        json = &jsonOut;
+    }
+    mt19937 rng(seed);
+    uniform_int_distribution<size_t> pickNode(0, nodes.size() - 1);
+    cout << mapFile << ": " << nodes.size() << " intersections and shape points" << endl;
+
+    //map load
+    BenchResult load = measure("streetmap_load", 5, 1, [&](size_t)
+    {
+        StreetMap sm;
+        sm.load(mapFile);
+    });
+    report(load, json);
+
+    //hash map insert and find
+    {
+        ExpandableHashMap<GeoCoord, size_t>* hm = nullptr;
+        BenchResult insert = measure("hashmap_insert", 5, nodes.size(), [&](size_t op)
+        {
+            size_t k = op % nodes.size();
+            if (k == 0)
+            {
+                delete hm;
+                hm = new ExpandableHashMap<GeoCoord, size_t>;
+            }
+            hm->associate(nodes[k], k);
+        });
+        report(insert, json);
+
+        size_t found = 0;
+        BenchResult find = measure("hashmap_find", 100, 1000, [&](size_t op)
+        {
+            if (hm->find(nodes[(op * 7919) % nodes.size()]) != nullptr)
+                found++;
+        });
+        find.note = to_string(found) + " hits";
+        report(find, json);
+        delete hm;
+    }
+
+    StreetMap sm;
+    sm.load(mapFile);
+
+    //segment lookup
+    BenchResult lookup = measure("streetmap_segments", 100, 1000, [&](size_t op)
+    {
+        vector<StreetSegment> segs;
+        sm.getSegmentsThatStartWith(nodes[(op * 7919) % nodes.size()], segs);
+    });
+    report(lookup, json);
+
+    //the intersection graph the router searches by default
+    {
+        size_t numNodes = 0, numEdges = 0;
+        BenchResult build = measure("chain_graph_build", 3, 1, [&](size_t)
+        {
+            ChainGraph graph(sm);
+            numNodes = graph.numNodes();
+            numEdges = graph.numEdges();
+        });
+        build.note = to_string(nodes.size()) + " points to " + to_string(numNodes) + " nodes, "
+            + to_string(numEdges) + " edges";
+        report(build, json);
+    }
+
+    //point-to-point queries over random node pairs, on the default Hilbert
+    //layout and then on the others, and point by point, for comparison; then
+    //one segment long, where setting up a search costs more than running it
+    {
+        vector<pair<size_t, size_t>> pairs;
+        for (size_t k = 0; k < numQueries; k++)
+            pairs.push_back(make_pair(pickNode(rng), pickNode(rng)));
+        vector<pair<GeoCoord, GeoCoord>> shortPairs;
+        for (size_t k = 0; k < numQueries; k++)
+        {
+            vector<StreetSegment> segs;
+            if (sm.getSegmentsThatStartWith(nodes[pickNode(rng)], segs) && !segs.empty())
+                shortPairs.push_back(make_pair(segs[0].start, segs[0].end));
+        }
+        MapLayout layouts[] = { LAYOUT_HILBERT, LAYOUT_BFS, LAYOUT_FILE_ORDER, LAYOUT_HILBERT };
+        const char* names[] = { "router_query", "router_query_bfs", "router_query_file_order",
+            "router_query_uncontracted" };
+        for (size_t l = 0; l < 4; l++)
+        {
+            StreetMap laidOut;
+            laidOut.setLayout(layouts[l]);
+            laidOut.load(mapFile);
+            PointToPointRouter router(&laidOut);
+            router.setChainContraction(l != 3);
+            //the first search builds the intersection graph
+            {
+                list<StreetSegment> segs;
+                double dist;
+                router.generatePointToPointRoute(nodes[pairs[0].first], nodes[pairs[0].second], segs, dist);
+            }
+            size_t routed = 0;
+            BenchResult route = measure(names[l], numQueries, 1, [&](size_t op)
+            {
+                list<StreetSegment> segs;
+                double dist;
+                if (router.generatePointToPointRoute(nodes[pairs[op].first], nodes[pairs[op].second],
+                    segs, dist) == DELIVERY_SUCCESS)
+                    routed++;
+            });
+            route.note = to_string(routed) + "/" + to_string(numQueries) + " routed";
+            report(route, json);
+
+            if (layouts[l] != LAYOUT_HILBERT)
+                continue;
+            routed = 0;
+            BenchResult shortRoute = measure(l == 3 ? "router_query_short_uncontracted" : "router_query_short",
+                shortPairs.size(), 1, [&](size_t op)
+            {
+                list<StreetSegment> segs;
+                double dist;
+                if (router.generatePointToPointRoute(shortPairs[op].first, shortPairs[op].second,
+                    segs, dist) == DELIVERY_SUCCESS)
+                    routed++;
+            });
+            shortRoute.note = to_string(routed) + "/" + to_string(shortPairs.size()) + " routed";
+            report(shortRoute, json);
+        }
+    }
+
+    //optimizer time against stop count
+    {
+        DeliveryOptimizer optimizer(&sm);
+        size_t stopCounts[] = { 5, 10, 25, 50, 100, 200 };
+        for (size_t n : stopCounts)
+        {
+            vector<vector<DeliveryRequest>> batches(20);
+            for (size_t b = 0; b < batches.size(); b++)
+            {
+                for (size_t k = 0; k < n; k++)
+                    batches[b].push_back(DeliveryRequest("item", nodes[pickNode(rng)]));
+            }
+            GeoCoord depot = nodes[pickNode(rng)];
+            BenchResult opt = measure("optimizer_" + to_string(n) + "_stops", batches.size(), 1, [&](size_t op)
+            {
+                double oldDist, newDist;
+                optimizer.optimizeDeliveryOrder(depot, batches[op], oldDist, newDist);
+            });
+            report(opt, json);
+        }
+    }
+    return 0;
+}
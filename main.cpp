@@ -1,19 +1,98 @@
 #include "provided.h"
+#include "ThreadPool.h"
+#include "PlanServer.h"
+#include "BinaryRouteWriter.h"
+#include "PlanStats.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <deque>
+#include <future>
+#include <chrono>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 using namespace std;
 
-bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v);
-bool parseDelivery(string line, string& lat, string& lon, string& item);
+bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v, ostream& diag);
+bool readDeliveryRequests(istream& inf, GeoCoord& depot, vector<DeliveryRequest>& v, ostream& diag);
+bool parseDelivery(string line, string& lat, string& lon, string& item, ostream& diag);
+DeliveryResult describePlan(const DeliveryPlanner& dp, const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries, string& text);
+int runBatch(const DeliveryPlanner& dp, ThreadPool& workers, string manifestFile);
+int writeBinaryPlan(const DeliveryPlanner& dp, const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries, string outputFile);
+
+// Formats every step of the plan straight into one reusable text buffer.
+class DescriptionWriter : public DeliveryCommandSink
+{
+public:
+    DescriptionWriter(string& text)
+        : m_text(text)
+    {}
+    void accept(const DeliveryStep& step)
+    {
+        appendDescription(step, m_text);
+        m_text += '\n';
+    }
+private:
+    string& m_text;
+};
+
+// Dumps the planner's statistics to cerr on the way out of main.
+struct StatsReporter
+{
+    PlanStats* stats;
+    ~StatsReporter()
+    {
+        if (stats != nullptr)
+            stats->dump(cerr);
+    }
+};
 
 int main(int argc, char* argv[])
 {
-    if (argc != 3)
+    //-stats and -tilecap may go anywhere on the command line
+    PlanStats stats;
+    StatsReporter reporter = { nullptr };
+    size_t tileCapMB = 0;
+    bool badTileCap = false;
+    vector<char*> args;
+    for (int k = 0; k < argc; k++)
+    {
+        if (k > 0 && string(argv[k]) == "-stats")
+            reporter.stats = &stats;
+        else if (k > 0 && k + 1 < argc && string(argv[k]) == "-tilecap")
+        {
+            //the whole argument must be a number of megabytes
+            const char* first = argv[++k];
+            const char* last = first + strlen(first);
+            from_chars_result res = from_chars(first, last, tileCapMB);
+            badTileCap = badTileCap || res.ec != errc() || res.ptr != last;
+        }
+        else
+            args.push_back(argv[k]);
+    }
+    argc = args.size();
+    argv = args.data();
+
+    if (argc >= 4 && string(argv[1]) == "-client")
+        return runPlanClient(argv[2], vector<string>(argv + 3, argv + argc));
+
+    bool batch = (argc == 4 && string(argv[2]) == "-batch");
+    bool serve = (argc == 4 && string(argv[2]) == "-serve");
+    bool binary = (argc == 5 && string(argv[3]) == "-binary");
+    if ((argc != 3 && !batch && !serve && !binary) || badTileCap)
     {
         cout << "Usage: " << argv[0] << " mapdata.txt deliveries.txt" << endl;
+        cout << "       " << argv[0] << " mapdata.txt deliveries.txt -binary route.bin" << endl;
+        cout << "       " << argv[0] << " mapdata.txt -batch manifest.txt" << endl;
+        cout << "       " << argv[0] << " mapdata.txt -serve socket" << endl;
+        cout << "       " << argv[0] << " -client socket deliveries.txt..." << endl;
+        cout << "Add -stats to print search and planning statistics to cerr." << endl;
+        cout << "Add -tilecap MB to keep at most MB megabytes of a tiled map in memory." << endl;
         return 1;
     }
   
@@ -24,10 +103,22 @@ int main(int argc, char* argv[])
         cout << "Unable to load map data file " << argv[1] << endl;
         return 1;
     }
+    sm.setTileMemoryLimit(tileCapMB * 1000000);
+
+    //one thread per core, for the planner and batch jobs alike
+    ThreadPool workers;
+    DeliveryPlanner dp(&sm, &workers);
+    dp.setStats(reporter.stats);
+    //build the routing graph now, not during the first plan
+    dp.warmUp();
+    if (batch)
+        return runBatch(dp, workers, argv[3]);
+    if (serve)
+        return runPlanServer(dp, argv[3]);
 
     GeoCoord depot;
     vector<DeliveryRequest> deliveries;
-    if (!loadDeliveryRequests(argv[2], depot, deliveries))
+    if (!loadDeliveryRequests(argv[2], depot, deliveries, cout))
     {
         cout << "Unable to load delivery request file " << argv[2] << endl;
         return 1;
@@ -35,10 +126,51 @@ int main(int argc, char* argv[])
 
     cout << "Generating route...\n\n";
 
-    DeliveryPlanner dp(&sm);
-    vector<DeliveryCommand> dcs;
-    double totalMiles;
-    DeliveryResult result = dp.generateDeliveryPlan(depot, deliveries, dcs, totalMiles);
+    if (binary)
+        return writeBinaryPlan(dp, depot, deliveries, argv[4]);
+
+    string text;
+    DeliveryResult result = describePlan(dp, depot, deliveries, text);
+    cout << text << flush;
+    return result == DELIVERY_SUCCESS ? 0 : 1;
+}
+
+// Produce the directions for one set of deliveries, or the reason why there
+// are none, exactly as they are printed for a single deliveries file.
+DeliveryResult describePlan(const DeliveryPlanner& dp, const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries, string& text)
+{
+    size_t preamble = text.size();
+    text += "Starting at the depot...\n";
+    DescriptionWriter writer(text);
+    double totalMiles = 0;
+    DeliveryResult result = dp.generateDeliveryPlan(depot, deliveries, writer, totalMiles);
+    if (result != DELIVERY_SUCCESS)
+    {
+        text.resize(preamble);
+        if (result == BAD_COORD)
+            text += "One or more depot or delivery coordinates are invalid.\n";
+        else
+            text += "No route can be found to deliver all items.\n";
+        return result;
+    }
+    char miles[32];
+    to_chars_result res = to_chars(miles, miles + sizeof(miles), totalMiles, chars_format::fixed, 2);
+    text += "You are back at the depot and your deliveries are done!\n";
+    text.append(miles, res.ptr);
+    text += " miles travelled for all deliveries.\n";
+    return result;
+}
+
+// Write the plan's commands and route geometry to outputFile in the compact
+// format described in BinaryRouteWriter.h.
+int writeBinaryPlan(const DeliveryPlanner& dp, const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries, string outputFile)
+{
+    string data;
+    BinaryRouteWriter writer(data);
+    double totalMiles = 0;
+    DeliveryResult result = dp.generateDeliveryPlan(depot, deliveries, writer, totalMiles);
     if (result == BAD_COORD)
     {
         cout << "One or more depot or delivery coordinates are invalid." << endl;
@@ -49,53 +181,162 @@ int main(int argc, char* argv[])
         cout << "No route can be found to deliver all items." << endl;
         return 1;
     }
-    cout << "Starting at the depot...\n";
-    for (const auto& dc : dcs)
-        cout << dc.description() << endl;
-    cout << "You are back at the depot and your deliveries are done!\n";
-    cout.setf(ios::fixed);
-    cout.precision(2);
-    cout << totalMiles << " miles travelled for all deliveries." << endl;
+    writer.finish(result, totalMiles);
+
+    ofstream outf(outputFile, ios::binary);
+    if (!outf || !outf.write(data.data(), data.size()))
+    {
+        cout << "Unable to write route file " << outputFile << endl;
+        return 1;
+    }
+    cout << "Wrote " << data.size() << " bytes of route data to " << outputFile << endl;
+    return 0;
+}
+
+struct BatchJobResult
+{
+    string text;
+    bool succeeded;
+    double milliseconds;
+};
+
+// nearest-rank percentile of an ascending list of samples
+double percentile(const vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.999999);
+    if (rank == 0)
+        rank = 1;
+    return sorted[min(rank, sorted.size()) - 1];
+}
+
+// Plan every deliveries file named in the manifest (one path per line)
+// against the already loaded map. Jobs run on the planner's worker pool,
+// but results are written in manifest order; a summary goes to cerr at the
+// end.
+int runBatch(const DeliveryPlanner& dp, ThreadPool& workers, string manifestFile)
+{
+    ifstream manifest(manifestFile);
+    if (!manifest)
+    {
+        cout << "Unable to load manifest file " << manifestFile << endl;
+        return 1;
+    }
+    vector<string> jobs;
+    string line;
+    while (getline(manifest, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (!line.empty())
+            jobs.push_back(line);
+    }
+
+    size_t window = 4 * max(thread::hardware_concurrency(), 1u);   //jobs in flight at once
+    deque<future<BatchJobResult>> pending;
+    vector<double> latencies;
+    size_t failures = 0;
+    size_t next = 0;
+    auto batchStart = chrono::steady_clock::now();
+    for (size_t k = 0; k < jobs.size(); k++)
+    {
+        for (; next < jobs.size() && next < k + window; next++)
+        {
+            pending.push_back(workers.submit([&dp, &jobs, next]()
+            {
+                auto jobStart = chrono::steady_clock::now();
+                BatchJobResult res;
+                try
+                {
+                    GeoCoord depot;
+                    vector<DeliveryRequest> deliveries;
+                    ostringstream diag;
+                    if (!loadDeliveryRequests(jobs[next], depot, deliveries, diag))
+                    {
+                        res.text = "Unable to load delivery request file " + jobs[next] + "\n";
+                        res.succeeded = false;
+                    }
+                    else
+                    {
+                        res.text = diag.str();
+                        res.succeeded = (describePlan(dp, depot, deliveries, res.text) == DELIVERY_SUCCESS);
+                    }
+                }
+                catch (const exception&)
+                {
+                    //a coordinate that isn't a number fails this job, not the batch
+                    res.text = "Bad number in delivery request file " + jobs[next] + "\n";
+                    res.succeeded = false;
+                }
+                res.milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - jobStart).count();
+                return res;
+            }));
+        }
+        BatchJobResult res = workers.get(pending.front());
+        pending.pop_front();
+        cout << "Job " << k + 1 << ": " << jobs[k] << "\n" << res.text << "\n";
+        latencies.push_back(res.milliseconds);
+        if (!res.succeeded)
+            failures++;
+    }
+    cout << flush;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - batchStart).count();
+
+    sort(latencies.begin(), latencies.end());
+    cerr.setf(ios::fixed);
+    cerr.precision(2);
+    cerr << jobs.size() << " jobs (" << failures << " failed) in " << seconds << " s, "
+        << (seconds > 0 ? jobs.size() / seconds : 0) << " jobs/s" << endl;
+    cerr << "latency ms: p50 " << percentile(latencies, 50) << ", p90 " << percentile(latencies, 90)
+        << ", p99 " << percentile(latencies, 99) << ", max " << percentile(latencies, 100) << endl;
+    return failures == 0 ? 0 : 1;
 }
 
-bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v)
+bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v, ostream& diag)
 {
     ifstream inf(deliveriesFile);
     if (!inf)
         return false;
+    return readDeliveryRequests(inf, depot, v, diag);
+}
+
+bool readDeliveryRequests(istream& inf, GeoCoord& depot, vector<DeliveryRequest>& v, ostream& diag)
+{
     string lat;
     string lon;
-    inf >> lat >> lon;
+    if (!(inf >> lat >> lon))
+        return false;
     inf.ignore(10000, '\n');
     depot = GeoCoord(lat, lon);
     string line;
     while (getline(inf, line))
     {
         string item;
-        if (parseDelivery(line, lat, lon, item))
+        if (parseDelivery(line, lat, lon, item, diag))
             v.push_back(DeliveryRequest(item, GeoCoord(lat, lon)));
     }
     return true;
 }
 
-bool parseDelivery(string line, string& lat, string& lon, string& item)
+bool parseDelivery(string line, string& lat, string& lon, string& item, ostream& diag)
 {
     const size_t colon = line.find(':');
     if (colon == string::npos)
     {
-        cout << "Missing colon in deliveries file line: " << line << endl;
+        diag << "Missing colon in deliveries file line: " << line << endl;
         return false;
     }
     istringstream iss(line.substr(0, colon));
     if (!(iss >> lat >> lon))
     {
-        cout << "Bad format in deliveries file line: " << line << endl;
+        diag << "Bad format in deliveries file line: " << line << endl;
         return false;
     }
     item = line.substr(colon + 1);
     if (item.empty())
     {
-        cout << "Missing item in deliveries file line: " << line << endl;
+        diag << "Missing item in deliveries file line: " << line << endl;
         return false;
     }
     return true;
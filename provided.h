@@ -8,6 +8,11 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <charconv>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
 
 enum DeliveryResult
 {
@@ -73,6 +78,25 @@ bool operator==(const StreetSegment& lhs, const StreetSegment& rhs)
 
 class StreetMapImpl;
 
+// The order a loaded map keeps its points in memory: along a Hilbert curve
+// over the map's bounding box, breadth first along the streets, or as they
+// first appear in the map data file.
+enum MapLayout
+{
+    LAYOUT_HILBERT, LAYOUT_BFS, LAYOUT_FILE_ORDER
+};
+
+// How much of a tiled map is in memory, and how it got there.
+struct TileCacheStats
+{
+    size_t tiles = 0;
+    size_t loadedTiles = 0;
+    size_t loadedBytes = 0;     // estimated
+    size_t loads = 0;
+    size_t evictions = 0;
+    size_t failedLoads = 0;     // tile files that wouldn't open or read
+};
+
 class StreetMap
 {
 public:
@@ -80,6 +104,36 @@ public:
     ~StreetMap();
     bool load(std::string mapFile);
     bool getSegmentsThatStartWith(const GeoCoord& gc, std::vector<StreetSegment>& segs) const;
+    // Every GeoCoord that starts a segment, i.e. every point of the map.
+    void getAllCoords(std::vector<GeoCoord>& coords) const;
+    // A map loaded from a tile index (see splitMapIntoTiles) reads each tile
+    // the first time a query touches it, then unloads the least recently
+    // used tiles whenever the loaded ones take more than this many bytes.
+    // 0, the default, keeps every tile once loaded. A tile whose file won't
+    // open or read has no segments for queries, and isn't kept: the next
+    // query to touch it reads it again, and getTileCacheStats counts each
+    // failure.
+    void setTileMemoryLimit(size_t bytes);
+    TileCacheStats getTileCacheStats() const;
+    // Lay out the maps and tiles loaded from now on this way; LAYOUT_HILBERT
+    // unless set.
+    void setLayout(MapLayout layout);
+    // Which connected piece of the map gc lies on, numbered when the map was
+    // loaded; two points are joined by some route exactly when their
+    // components match. False if gc isn't on the map, and always false for a
+    // tiled map, whose tiles can't tell what joins up beyond them.
+    bool getComponent(const GeoCoord& gc, size_t& component) const;
+    // A map loaded whole, for as long as it stays loaded, numbers its points
+    // from 0 to getNumPoints() - 1, and its segments, in both directions,
+    // with the segments that start at each point numbered one after the
+    // other; a router can then keep numbers rather than copies of the map.
+    // A tiled map numbers nothing: getNumPoints is 0 and getPointId false.
+    size_t getNumPoints() const;
+    bool getPointId(const GeoCoord& gc, size_t& id) const;
+    // The segments that start at point pointId are numbered first to
+    // first + count - 1.
+    void getSegmentIds(size_t pointId, size_t& first, size_t& count) const;
+    const StreetSegment& getSegment(size_t segmentId) const;
     // We prevent a StreetMap object from being copied or assigned.
     StreetMap(const StreetMap&) = delete;
     StreetMap& operator=(const StreetMap&) = delete;
@@ -87,6 +141,35 @@ private:
     StreetMapImpl* m_impl;
 };
 
+// Split a map data file into square tiles tileDegrees on a side, each one a
+// map data file of every segment with an end in that tile. Writes the tile
+// files next to indexFile, which StreetMap::load then accepts in place of a
+// map data file: a line "#tiles <tileDegrees>" followed by one line
+// "<row> <col> <tile file>" per tile, where a point lies in tile
+// floor(latitude / tileDegrees), floor(longitude / tileDegrees).
+bool splitMapIntoTiles(const std::string& mapFile, const std::string& indexFile, double tileDegrees);
+
+// Tells a search or plan to stop early, once cancel() has been called on it
+// or any copy of it, from any thread, or once its deadline has passed.
+class CancellationToken
+{
+public:
+    CancellationToken(std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max())
+        : m_cancelled(std::make_shared<std::atomic<bool>>(false)), m_deadline(deadline)
+    {}
+    void cancel() const { m_cancelled->store(true); }
+    bool isCancelled() const
+    {
+        return m_cancelled->load(std::memory_order_relaxed) ||
+            (m_deadline != std::chrono::steady_clock::time_point::max() &&
+                std::chrono::steady_clock::now() >= m_deadline);
+    }
+private:
+    std::shared_ptr<std::atomic<bool>> m_cancelled;
+    std::chrono::steady_clock::time_point m_deadline;
+};
+
+class PlanStats;
 class PointToPointRouterImpl;
 
 class PointToPointRouter
@@ -99,6 +182,30 @@ public:
         const GeoCoord& end,
         std::list<StreetSegment>& route,
         double& totalDistanceTravelled) const;
+    // Give up with NO_ROUTE as soon as cancel is cancelled, setting
+    // interrupted; interrupted is false whenever the result doesn't depend on
+    // cancel, including a NO_ROUTE or BAD_COORD found before giving up.
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        std::list<StreetSegment>& route,
+        double& totalDistanceTravelled,
+        const CancellationToken& cancel,
+        bool& interrupted) const;
+    // Record every search into stats from now on; nullptr stops recording.
+    void setStats(PlanStats* stats);
+    // On by default: the first search builds a graph of the map's
+    // intersections, with each run of shape points between two of them
+    // contracted into one edge, and every search then runs over that. It
+    // takes the map as loaded at the time, and isn't built for tiled maps.
+    // Turn it off before the first search to search the map point by point.
+    // Searches with a CancellationToken never wait for the graph: the first
+    // of them starts building it in the background, and they search point
+    // by point until it's ready.
+    void setChainContraction(bool on);
+    // Build the graph now, straight after loading the map, so that no
+    // search has to wait for it or go without.
+    void warmUp() const;
     // We prevent a PointToPointRouter object from being copied or assigned.
     PointToPointRouter(const PointToPointRouter&) = delete;
     PointToPointRouter& operator=(const PointToPointRouter&) = delete;
@@ -127,6 +234,14 @@ public:
         std::vector<DeliveryRequest>& deliveries,
         double& oldCrowDistance,
         double& newCrowDistance) const;
+    // Stop improving the order as soon as cancel is cancelled; deliveries is
+    // still a complete order, just a less optimized one.
+    void optimizeDeliveryOrder(
+        const GeoCoord& depot,
+        std::vector<DeliveryRequest>& deliveries,
+        double& oldCrowDistance,
+        double& newCrowDistance,
+        const CancellationToken& cancel) const;
     // We prevent a DeliveryOptimizer object from being copied or assigned.
     DeliveryOptimizer(const DeliveryOptimizer&) = delete;
     DeliveryOptimizer& operator=(const DeliveryOptimizer&) = delete;
@@ -208,18 +323,170 @@ private:
     double       m_distance;    // 1.92 (in miles)
 };
 
+// A compact delivery command, pushed to a DeliveryCommandSink as soon as its
+// leg has been routed. The strings it points to only stay valid for the
+// duration of the call; the direction is a string literal.
+struct DeliveryStep
+{
+    enum StepType { PROCEED, TURN, DELIVER };
+    StepType           type;
+    const char*        direction;   // "left" for turn or "northeast" for proceed
+    const std::string* streetName;  // nullptr for a delivery
+    const std::string* item;        // nullptr unless delivering
+    double             distance;    // in miles, 0 unless proceeding
+};
+
+class DeliveryCommandSink
+{
+public:
+    virtual ~DeliveryCommandSink() {}
+    virtual void accept(const DeliveryStep& step) = 0;
+    // Called with every street segment of the route in driving order, so the
+    // segments of a street arrive before the PROCEED step that covers them.
+    // Sinks that only need the directions can ignore them.
+    virtual void acceptSegment(const StreetSegment&) {}
+};
+
+// Append the same text as DeliveryCommand::description() to buffer, without
+// going through an ostringstream.
+inline void appendDescription(const DeliveryStep& step, std::string& buffer)
+{
+    switch (step.type)
+    {
+    case DeliveryStep::TURN:
+        buffer += "Turn ";
+        buffer += step.direction;
+        buffer += " on ";
+        buffer += *step.streetName;
+        break;
+    case DeliveryStep::PROCEED:
+    {
+        char miles[32];
+        std::to_chars_result res = std::to_chars(miles, miles + sizeof(miles), step.distance,
+            std::chars_format::fixed, 2);
+        buffer += "Proceed ";
+        buffer += step.direction;
+        buffer += " on ";
+        buffer += *step.streetName;
+        buffer += " for ";
+        buffer.append(miles, res.ptr);
+        buffer += " miles";
+        break;
+    }
+    case DeliveryStep::DELIVER:
+        buffer += "DELIVER ";
+        buffer += *step.item;
+        break;
+    }
+}
+
+// An ordered delivery plan that remembers the commands of every leg, so that
+// it can be amended later without re-routing the legs that did not change.
+// legCommands[k] drives from the previous stop (or the depot) to stops[k] and
+// ends with its DELIVER command; the last leg returns to the depot.
+struct DeliveryPlan
+{
+    GeoCoord depot;
+    std::vector<DeliveryRequest> stops;
+    std::vector<std::vector<DeliveryCommand>> legCommands;
+    std::vector<double> legDistances;
+    double totalDistance = 0;
+
+    void getCommands(std::vector<DeliveryCommand>& commands) const
+    {
+        commands.clear();
+        for (size_t k = 0; k < legCommands.size(); k++)
+            commands.insert(commands.end(), legCommands[k].begin(), legCommands[k].end());
+    }
+};
+
+// What generateDeliveryPlanAsync comes up with. A plan that was cancelled
+// or ran out of time is cut back to the legs routed by then: plan holds the
+// stops they reach in order, with no leg back to the depot, and unserved
+// holds the stops after them.
+struct AsyncPlanResult
+{
+    DeliveryResult result = DELIVERY_SUCCESS;
+    bool complete = true;
+    DeliveryPlan plan;
+    std::vector<DeliveryRequest> unserved;
+};
+
 class DeliveryPlannerImpl;
+class ThreadPool;
 
 class DeliveryPlanner
 {
 public:
-    DeliveryPlanner(const StreetMap* sm);
+    // Routes on pool's threads, so that several planners and their callers
+    // can share one pool, which must outlive the planner. Planners given no
+    // pool share a default one, with a thread per core, started the first
+    // time any of them plans.
+    DeliveryPlanner(const StreetMap* sm, ThreadPool* pool = nullptr);
     ~DeliveryPlanner();
     DeliveryResult generateDeliveryPlan(
         const GeoCoord& depot,
         const std::vector<DeliveryRequest>& deliveries,
         std::vector<DeliveryCommand>& commands,
         double& totalDistanceTravelled) const;
+    DeliveryResult generateDeliveryPlan(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        DeliveryPlan& plan) const;
+    // Insert late deliveries into an existing plan at their cheapest
+    // positions, re-routing only the legs that change. A plan cut short by
+    // generateDeliveryPlanAsync gets its way back to the depot routed too,
+    // and a plan whose legs don't match its stops is routed afresh.
+    DeliveryResult insertDeliveries(
+        DeliveryPlan& plan,
+        const std::vector<DeliveryRequest>& lateDeliveries,
+        std::vector<DeliveryCommand>& commands,
+        double& totalDistanceTravelled) const;
+    // Push the commands to sink leg by leg as they are routed instead of
+    // collecting them. If a leg fails, the commands of the legs before it
+    // have already been delivered to the sink.
+    DeliveryResult generateDeliveryPlan(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        DeliveryCommandSink& sink,
+        double& totalDistanceTravelled) const;
+    // Split the deliveries among several drivers by an angular sweep around
+    // the depot, then optimize and route each driver's share in parallel.
+    // Items for the same spot go to one driver, unless keeping them together
+    // would leave some driver more than it can carry. A maxStopsPerDriver of
+    // 0 means the drivers' capacity is unlimited. Returns NO_ROUTE without
+    // planning anything if numDrivers isn't positive, or if the drivers can't
+    // carry every item between them.
+    DeliveryResult generateDeliveryPlans(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        int numDrivers,
+        std::vector<std::vector<DeliveryCommand>>& commands,
+        std::vector<double>& totalDistances,
+        int maxStopsPerDriver = 0) const;
+    // Find, without routing, the deliveries that no route from the depot can
+    // reach: BAD_COORD if the depot or any of them is off the map, else
+    // NO_ROUTE if any lies on a piece of the map cut off from the depot.
+    // Every plan makes this check before routing, so a stop that can't be
+    // reached fails the plan straight away. A tiled map has no components,
+    // so there only the depot is checked.
+    DeliveryResult findUnreachable(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        std::vector<DeliveryRequest>& unreachable) const;
+    // Plan on the planner's threads, checking cancel while optimizing and
+    // routing, and return the best plan made before it was cancelled. The
+    // planner must outlive the future.
+    std::future<AsyncPlanResult> generateDeliveryPlanAsync(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        CancellationToken cancel = CancellationToken()) const;
+    // Record every plan and search into stats from now on; nullptr stops
+    // recording. Don't call it while plans are being generated.
+    void setStats(PlanStats* stats);
+    // Get the router ready (see PointToPointRouter::warmUp), so that the
+    // first plan, and its deadline, don't pay for it.
+    void warmUp() const;
     // We prevent a DeliveryPlanner object from being copied or assigned.
     DeliveryPlanner(const DeliveryPlanner&) = delete;
     DeliveryPlanner& operator=(const DeliveryPlanner&) = delete;
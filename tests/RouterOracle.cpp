@@ -0,0 +1,139 @@
+#include "RouterOracle.h"
+#include <map>
+#include <set>
+#include <queue>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+bool checkRoute(const StreetMap& sm, const GeoCoord& start, const GeoCoord& end,
+    const list<StreetSegment>& route, double distance, double tolerance, string& problem);
+
+DeliveryResult oracleRoute(const StreetMap& sm, const GeoCoord& start, const GeoCoord& end, double& distance)
+{
+    vector<StreetSegment> segs;
+    if (!sm.getSegmentsThatStartWith(start, segs) || !sm.getSegmentsThatStartWith(end, segs))
+        return BAD_COORD;
+
+    map<GeoCoord, double> best;
+    set<GeoCoord> settled;
+    priority_queue<pair<double, GeoCoord>, vector<pair<double, GeoCoord>>,
+        greater<pair<double, GeoCoord>>> frontier;
+    best[start] = 0;
+    frontier.push(make_pair(0.0, start));
+    while (!frontier.empty())
+    {
+        double cost = frontier.top().first;
+        GeoCoord curr = frontier.top().second;
+        frontier.pop();
+        if (!settled.insert(curr).second)
+            continue;   //a stale entry
+        if (curr == end)
+        {
+            distance = cost;
+            return DELIVERY_SUCCESS;
+        }
+        sm.getSegmentsThatStartWith(curr, segs);
+        for (size_t k = 0; k < segs.size(); k++)
+        {
+            double next = cost + distanceEarthMiles(segs[k].start, segs[k].end);
+            auto it = best.find(segs[k].end);
+            if (it == best.end() || next < it->second)
+            {
+                best[segs[k].end] = next;
+                frontier.push(make_pair(next, segs[k].end));
+            }
+        }
+    }
+    return NO_ROUTE;
+}
+
+bool checkRoute(const StreetMap& sm, const GeoCoord& start, const GeoCoord& end,
+    const list<StreetSegment>& route, double distance, double tolerance, string& problem)
+{
+    GeoCoord at = start;
+    double total = 0;
+    vector<StreetSegment> segs;
+    for (const StreetSegment& seg : route)
+    {
+        if (!(seg.start == at))
+        {
+            problem = "route jumps from " + at.latitudeText + " " + at.longitudeText
+                + " to " + seg.start.latitudeText + " " + seg.start.longitudeText;
+            return false;
+        }
+        sm.getSegmentsThatStartWith(seg.start, segs);
+        bool inMap = false;
+        for (size_t k = 0; k < segs.size() && !inMap; k++)
+            inMap = (segs[k].end == seg.end && segs[k].name == seg.name);
+        if (!inMap)
+        {
+            problem = "segment of " + seg.name + " isn't in the map";
+            return false;
+        }
+        total += distanceEarthMiles(seg.start, seg.end);
+        at = seg.end;
+    }
+    if (!(at == end))
+    {
+        problem = "route stops short of the destination";
+        return false;
+    }
+    if (abs(total - distance) > tolerance * max(distance, 1e-9))
+    {
+        problem = "segments add up to " + to_string(total) + " miles, not " + to_string(distance);
+        return false;
+    }
+    return true;
+}
+
+OracleReport validateRouter(const StreetMap& sm, const RouteFunction& router,
+    const vector<pair<GeoCoord, GeoCoord>>& pairs, double tolerance, ostream& log)
+{
+    OracleReport report;
+    for (size_t k = 0; k < pairs.size(); k++)
+    {
+        const GeoCoord& start = pairs[k].first;
+        const GeoCoord& end = pairs[k].second;
+        report.pairs++;
+
+        double oracleDist = 0;
+        auto oracleStart = chrono::steady_clock::now();
+        DeliveryResult expected = oracleRoute(sm, start, end, oracleDist);
+        report.oracleSeconds += chrono::duration<double>(chrono::steady_clock::now() - oracleStart).count();
+
+        list<StreetSegment> route;
+        double dist = 0;
+        auto routerStart = chrono::steady_clock::now();
+        DeliveryResult actual = router(start, end, route, dist);
+        report.routerSeconds += chrono::duration<double>(chrono::steady_clock::now() - routerStart).count();
+
+        string where = "pair " + to_string(k) + " (" + start.latitudeText + " " + start.longitudeText
+            + " to " + end.latitudeText + " " + end.longitudeText + "): ";
+        if (expected != actual)
+        {
+            report.mismatches++;
+            log << where << "status " << actual << ", oracle says " << expected << endl;
+            continue;
+        }
+        if (expected != DELIVERY_SUCCESS)
+            continue;
+
+        report.routed++;
+        double relErr = abs(dist - oracleDist) / max(oracleDist, 1e-9);
+        report.maxRelativeError = max(report.maxRelativeError, relErr);
+        if (relErr > tolerance)
+        {
+            report.mismatches++;
+            log << where << dist << " miles, oracle says " << oracleDist << endl;
+        }
+        string problem;
+        if (!checkRoute(sm, start, end, route, dist, tolerance, problem))
+        {
+            report.invalidRoutes++;
+            log << where << problem << endl;
+        }
+    }
+    return report;
+}
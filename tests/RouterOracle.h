@@ -0,0 +1,43 @@
+// RouterOracle.h
+
+#ifndef ROUTERORACLE_H
+#define ROUTERORACLE_H
+
+#include "provided.h"
+#include <functional>
+#include <iostream>
+#include <list>
+#include <utility>
+#include <vector>
+
+// Any point-to-point router, with the signature of
+// PointToPointRouter::generatePointToPointRoute.
+typedef std::function<DeliveryResult(const GeoCoord& start, const GeoCoord& end,
+    std::list<StreetSegment>& route, double& totalDistanceTravelled)> RouteFunction;
+
+// The shortest distance from start to end by plain Dijkstra over
+// StreetMap::getSegmentsThatStartWith, kept deliberately simple so it can be
+// trusted: no heuristic, std::map for its bookkeeping, and it stops only once
+// end has been settled.
+DeliveryResult oracleRoute(const StreetMap& sm, const GeoCoord& start, const GeoCoord& end, double& distance);
+
+struct OracleReport
+{
+    size_t pairs = 0;
+    size_t routed = 0;              // pairs the oracle could route
+    size_t mismatches = 0;          // status or distance disagrees with the oracle
+    size_t invalidRoutes = 0;       // segments that aren't in the map, don't join up or don't add up
+    double maxRelativeError = 0;    // over pairs both could route
+    double oracleSeconds = 0;
+    double routerSeconds = 0;
+
+    double speedup() const { return routerSeconds > 0 ? oracleSeconds / routerSeconds : 0; }
+};
+
+// Run the oracle and router over every pair, describing each disagreement
+// to log. A distance is a mismatch once its relative error exceeds
+// tolerance.
+OracleReport validateRouter(const StreetMap& sm, const RouteFunction& router,
+    const std::vector<std::pair<GeoCoord, GeoCoord>>& pairs, double tolerance, std::ostream& log);
+
+#endif // !ROUTERORACLE_H
@@ -0,0 +1,139 @@
+// End-to-end load test: generates cities of growing size, loads each one
+// through StreetMap and plans batches of deliveries with DeliveryPlanner,
+// reporting load time, throughput and tail latency per map size.
+//
+// Usage: load_test [-sizes 20,40,80] [-jobs J] [-stops S] [-dir directory]
+//
+// Fails if a generated city has no dead ends, or if any plan over it cannot
+// be routed.
+
+#include "provided.h"
+#include "MapGenerator.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+using namespace std;
+
+double percentile(vector<double> samples, double p)
+{
+    if (samples.empty())
+        return 0;
+    sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(p / 100 * samples.size() + 0.999999);
+    return samples[min(max(rank, size_t(1)), samples.size()) - 1];
+}
+
+int main(int argc, char* argv[])
+{
+    vector<int> sizes = { 20, 40, 80 };
+    int numJobs = 20;
+    int numStops = 10;
+    string dir = ".";
+    for (int k = 1; k < argc; k++)
+    {
+        string arg = argv[k];
+        if (arg == "-sizes" && k + 1 < argc)
+        {
+            sizes.clear();
+            istringstream iss(argv[++k]);
+            string size;
+            while (getline(iss, size, ','))
+                sizes.push_back(stoi(size));
+        }
+        else if (arg == "-jobs" && k + 1 < argc)
+            numJobs = stoi(argv[++k]);
+        else if (arg == "-stops" && k + 1 < argc)
+            numStops = stoi(argv[++k]);
+        else if (arg == "-dir" && k + 1 < argc)
+            dir = argv[++k];
+        else
+        {
+            cout << "Usage: " << argv[0] << " [-sizes 20,40,80] [-jobs J] [-stops S] [-dir directory]" << endl;
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    cout.setf(ios::fixed);
+    cout.precision(2);
+    for (size_t s = 0; s < sizes.size(); s++)
+    {
+        MapGenOptions mapOpts;
+        mapOpts.gridSize = sizes[s];
+        mapOpts.seed = sizes[s];
+        string mapFile = dir + "/load_test_map_" + to_string(sizes[s]) + ".txt";
+        GeneratedMap map;
+        {
+            ofstream mapOut(mapFile);
+            if (!mapOut)
+            {
+                cout << "Unable to write map data file " << mapFile << endl;
+                return 1;
+            }
+            generateMap(mapOpts, mapOut, map);
+        }
+
+        auto loadStart = chrono::steady_clock::now();
+        StreetMap sm;
+        if (!sm.load(mapFile))
+        {
+            cout << "Unable to load map data file " << mapFile << endl;
+            return 1;
+        }
+        double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - loadStart).count();
+        remove(mapFile.c_str());
+
+        //an intersection at the end of a single block is a dead end
+        size_t deadEnds = 0;
+        for (size_t k = 0; k < map.intersections.size(); k++)
+        {
+            vector<StreetSegment> segs;
+            if (sm.getSegmentsThatStartWith(map.intersections[k], segs) && segs.size() == 1)
+                deadEnds++;
+        }
+        if (deadEnds == 0)
+        {
+            cout << "grid " << sizes[s] << ": no dead ends" << endl;
+            failures++;
+        }
+
+        //half the jobs spread over the city, half clustered in a few spots
+        DeliveryPlanner dp(&sm);
+        vector<double> latencies;
+        auto batchStart = chrono::steady_clock::now();
+        for (int j = 0; j < numJobs; j++)
+        {
+            DeliveryGenOptions deliveryOpts;
+            deliveryOpts.numStops = numStops;
+            deliveryOpts.numClusters = (j % 2 == 0 ? 0 : 3);
+            deliveryOpts.seed = j + 1;
+            ostringstream ignored;
+            GeoCoord depot;
+            vector<DeliveryRequest> deliveries;
+            generateDeliveries(map, deliveryOpts, ignored, depot, deliveries);
+
+            auto jobStart = chrono::steady_clock::now();
+            vector<DeliveryCommand> commands;
+            double miles;
+            DeliveryResult result = dp.generateDeliveryPlan(depot, deliveries, commands, miles);
+            latencies.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - jobStart).count());
+            if (result != DELIVERY_SUCCESS)
+            {
+                cout << "grid " << sizes[s] << ", job " << j + 1 << ": plan failed with result " << result << endl;
+                failures++;
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - batchStart).count();
+
+        cout << "grid " << sizes[s] << ": " << map.numSegments << " segments, " << deadEnds << " dead ends, load "
+            << loadMs << " ms, "
+            << (seconds > 0 ? numJobs / seconds : 0) << " plans/s, latency ms p50 " << percentile(latencies, 50)
+            << ", p99 " << percentile(latencies, 99) << ", max " << percentile(latencies, 100) << endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
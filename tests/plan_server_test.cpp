@@ -0,0 +1,203 @@
+// PlanServer checks: starts GooberEats -serve on the real map and talks to
+// it the way misbehaving clients might, making sure that a client sending
+// its request slowly, or stopping half way through one, doesn't hold up
+// anyone else.
+//
+// Usage: plan_server_test GooberEats mapdata.txt deliveries.txt [-dir directory]
+//
+// Makes its socket in the directory. Fails if any check does.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+
+const int PLAN_SUCCESS = 0;     //DELIVERY_SUCCESS, the first status byte
+
+int failures = 0;
+
+void check(bool passed, const string& what)
+{
+    cout << (passed ? "ok     " : "FAILED ") << what << endl;
+    if (!passed)
+        failures++;
+}
+
+// A connection to the server, or -1. Reads on it give up after timeoutSeconds.
+int connectTo(const string& socketPath, int timeoutSeconds)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    timeval timeout = { timeoutSeconds, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+bool sendAll(int fd, const string& bytes)
+{
+    size_t sent = 0;
+    while (sent < bytes.size())
+    {
+        ssize_t n = send(fd, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool receiveAll(int fd, char* buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;   //hung up, or timed out
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+string frame(const string& payload)
+{
+    uint32_t len = payload.size();
+    char header[4] = { char(len >> 24), char(len >> 16), char(len >> 8), char(len) };
+    return string(header, 4) + payload;
+}
+
+// The status byte of the next response, or -1 if none comes in time.
+int receiveStatus(int fd)
+{
+    unsigned char header[4];
+    if (!receiveAll(fd, reinterpret_cast<char*>(header), 4))
+        return -1;
+    uint32_t len = (uint32_t(header[0]) << 24) | (uint32_t(header[1]) << 16) | (uint32_t(header[2]) << 8) | header[3];
+    string payload(len, '\0');
+    if (len == 0 || !receiveAll(fd, &payload[0], len))
+        return -1;
+    return static_cast<unsigned char>(payload[0]);
+}
+
+// Send a whole request on a connection of its own, and wait for the answer.
+int planOnce(const string& socketPath, const string& request)
+{
+    int fd = connectTo(socketPath, 10);
+    if (fd < 0)
+        return -1;
+    int status = sendAll(fd, frame(request)) ? receiveStatus(fd) : -1;
+    close(fd);
+    return status;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 4)
+    {
+        cout << "Usage: " << argv[0] << " GooberEats mapdata.txt deliveries.txt [-dir directory]" << endl;
+        return 1;
+    }
+    string server = argv[1];
+    string mapFile = argv[2];
+    string dir = ".";
+    if (argc == 6 && string(argv[4]) == "-dir")
+        dir = argv[5];
+    ifstream inf(argv[3]);
+    if (!inf)
+    {
+        cout << "Unable to load delivery request file " << argv[3] << endl;
+        return 1;
+    }
+    ostringstream contents;
+    contents << inf.rdbuf();
+    string request = contents.str();
+    string socketPath = dir + "/plan_server_test.sock";
+
+    unlink(socketPath.c_str());
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execl(server.c_str(), server.c_str(), mapFile.c_str(), "-serve", socketPath.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+
+    //wait for the map to load
+    int status = -1;
+    for (int tries = 0; tries < 300 && status == -1; tries++)
+    {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        status = planOnce(socketPath, request);
+    }
+    check(status == PLAN_SUCCESS, "the server answers a request");
+
+    //a client that has sent half its request, then one that has sent half
+    //of a length
+    string whole = frame(request);
+    int slow = connectTo(socketPath, 10);
+    int stalled = connectTo(socketPath, 10);
+    bool sentHalves = slow >= 0 && stalled >= 0 && sendAll(slow, whole.substr(0, whole.size() / 2)) &&
+        sendAll(stalled, whole.substr(0, 2));
+    this_thread::sleep_for(chrono::milliseconds(200));
+    auto start = chrono::steady_clock::now();
+    status = planOnce(socketPath, request);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    check(sentHalves && status == PLAN_SUCCESS && seconds < 5,
+        "other clients are served while some are part way through their requests");
+
+    //the slow client sends the rest in small pieces, and gets its answer
+    bool sentRest = true;
+    for (size_t k = whole.size() / 2; sentRest && k < whole.size(); k += 97)
+    {
+        sentRest = sendAll(slow, whole.substr(k, 97));
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    check(sentRest && receiveStatus(slow) == PLAN_SUCCESS, "a request sent in pieces is answered once it's whole");
+
+    //two requests in one write are both answered, in order
+    check(sendAll(slow, whole + whole) && receiveStatus(slow) == PLAN_SUCCESS && receiveStatus(slow) == PLAN_SUCCESS,
+        "requests sent back to back are each answered");
+
+    //a length too long for any request gets the client dropped
+    char tooLong[4] = { char(0x7f), char(0xff), char(0xff), char(0xff) };
+    int greedy = connectTo(socketPath, 10);
+    check(greedy >= 0 && sendAll(greedy, string(tooLong, 4)) && receiveStatus(greedy) == -1 &&
+        planOnce(socketPath, request) == PLAN_SUCCESS, "a client announcing too long a request is dropped");
+    if (greedy >= 0)
+        close(greedy);
+    if (slow >= 0)
+        close(slow);
+    if (stalled >= 0)
+        close(stalled);
+
+    kill(pid, SIGTERM);
+    int exitStatus;
+    check(waitpid(pid, &exitStatus, 0) == pid && WIFEXITED(exitStatus) && WEXITSTATUS(exitStatus) == 0,
+        "the server stops cleanly");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,732 @@
+// DeliveryPlanner checks on the real map: how plans behave when they are
+// cancelled or run out of time, how late deliveries are inserted into plans
+// of every shape, how stops are shared out among drivers, that a plan pushed
+// to a sink matches the one returned as commands, how items sharing a spot are
+// delivered together, and that a plan written by BinaryRouteWriter reads back
+// as the commands it was made of. Also how a tiled map copes with many threads
+// and with a tile file going missing.
+//
+// Usage: planner_test [mapdata.txt] [-dir directory]
+//
+// Writes tiled copies of the map into the directory. Fails if any check
+// does.
+
+#include "provided.h"
+#include "ThreadPool.h"
+#include "PlanStats.h"
+#include "BinaryRouteWriter.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <future>
+using namespace std;
+
+int failures = 0;
+
+void check(bool passed, const string& what)
+{
+    cout << (passed ? "ok     " : "FAILED ") << what << endl;
+    if (!passed)
+        failures++;
+}
+
+// A depot on the largest piece of the map, some stops joined to it, and one
+// stop on another piece.
+void pickStops(const StreetMap& sm, GeoCoord& depot, vector<DeliveryRequest>& joined, GeoCoord& cutOff)
+{
+    vector<GeoCoord> coords;
+    sm.getAllCoords(coords);
+    vector<size_t> componentSize;
+    for (size_t k = 0; k < coords.size(); k++)
+    {
+        size_t component;
+        sm.getComponent(coords[k], component);
+        if (component >= componentSize.size())
+            componentSize.resize(component + 1, 0);
+        componentSize[component]++;
+    }
+    size_t largest = 0;
+    for (size_t c = 1; c < componentSize.size(); c++)
+    {
+        if (componentSize[c] > componentSize[largest])
+            largest = c;
+    }
+
+    //spread the stops out over the map's points
+    bool haveDepot = false;
+    bool haveCutOff = false;
+    for (size_t k = 0; k < coords.size(); k += coords.size() / 97 + 1)
+    {
+        size_t component;
+        sm.getComponent(coords[k], component);
+        if (component != largest)
+        {
+            if (!haveCutOff)
+                cutOff = coords[k];
+            haveCutOff = true;
+        }
+        else if (!haveDepot)
+        {
+            depot = coords[k];
+            haveDepot = true;
+        }
+        else if (joined.size() < 6)
+            joined.push_back(DeliveryRequest("item " + to_string(joined.size() + 1), coords[k]));
+    }
+    for (size_t k = 0; !haveCutOff && k < coords.size(); k++)
+    {
+        size_t component;
+        sm.getComponent(coords[k], component);
+        if (component != largest)
+        {
+            cutOff = coords[k];
+            haveCutOff = true;
+        }
+    }
+}
+
+void testCancellation(const StreetMap& sm, const StreetMap& tiled)
+{
+    GeoCoord depot, cutOff;
+    vector<DeliveryRequest> joined;
+    pickStops(sm, depot, joined, cutOff);
+    CancellationToken expired(chrono::steady_clock::now() - chrono::seconds(1));
+
+    //the router only reports an interruption when it gave up on a search
+    PointToPointRouter router(&sm);
+    list<StreetSegment> route;
+    double miles;
+    bool interrupted = true;
+    check(router.generatePointToPointRoute(depot, cutOff, route, miles, expired, interrupted) == NO_ROUTE &&
+        !interrupted, "a route between pieces of the map is NO_ROUTE past its deadline, not interrupted");
+    check(router.generatePointToPointRoute(depot, joined.back().location, route, miles, expired,
+        interrupted) == NO_ROUTE && interrupted, "a search past its deadline is interrupted");
+
+    //a search with a deadline doesn't wait for the contracted graph, but
+    //starts building it; the searches after it use it once it's built, and
+    //search far fewer nodes for the same route
+    PointToPointRouter cold(&sm);
+    PlanStats coldStats;
+    cold.setStats(&coldStats);
+    CancellationToken generous(chrono::steady_clock::now() + chrono::seconds(60));
+    double coldMiles = -1;
+    double warmMiles = -2;
+    DeliveryResult coldResult = cold.generatePointToPointRoute(depot, joined.back().location, route, coldMiles,
+        generous, interrupted);
+    uint64_t coldExpanded = coldStats.nodesExpanded;
+    DeliveryResult warmResult = NO_ROUTE;
+    bool contracted = false;
+    for (int tries = 0; tries < 3000 && !contracted; tries++)
+    {
+        uint64_t before = coldStats.nodesExpanded;
+        warmResult = cold.generatePointToPointRoute(depot, joined.back().location, route, warmMiles,
+            generous, interrupted);
+        contracted = (coldStats.nodesExpanded - before < coldExpanded || !GOOBEREATS_STATS_ENABLED);
+        if (!contracted)
+            this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    check(coldResult == DELIVERY_SUCCESS && warmResult == DELIVERY_SUCCESS && fabs(coldMiles - warmMiles) < 1e-6 &&
+        contracted, "a search with a deadline starts building the contracted graph for later searches");
+
+    DeliveryPlanner dp(&sm);
+    vector<DeliveryRequest> deliveries = joined;
+    deliveries.insert(deliveries.begin() + 2, DeliveryRequest("cut off", cutOff));
+    AsyncPlanResult res = dp.generateDeliveryPlanAsync(depot, deliveries, expired).get();
+    check(res.result == NO_ROUTE, "a plan with a cut-off stop is NO_ROUTE past its deadline");
+
+    res = dp.generateDeliveryPlanAsync(depot, joined, expired).get();
+    check(res.result == DELIVERY_SUCCESS && !res.complete && res.plan.stops.size() + res.unserved.size() ==
+        joined.size() && res.plan.legCommands.size() == res.plan.stops.size(),
+        "a plan past its deadline is cut short, with every stop served or unserved");
+
+    res = dp.generateDeliveryPlanAsync(depot, joined).get();
+    check(res.result == DELIVERY_SUCCESS && res.complete && res.unserved.empty() &&
+        res.plan.legCommands.size() == joined.size() + 1, "a plan with no deadline is complete");
+
+    //a tiled map has no components, so only the router finds the stop is off the map
+    DeliveryPlanner tiledPlanner(&tiled);
+    deliveries = joined;
+    deliveries.insert(deliveries.begin() + 1, DeliveryRequest("nowhere", GeoCoord("0.5", "0.5")));
+    res = tiledPlanner.generateDeliveryPlanAsync(depot, deliveries, expired).get();
+    check(res.result == BAD_COORD, "a tiled plan with a stop off the map is BAD_COORD past its deadline");
+}
+
+// Which result a plan reports when its legs fail or are cut short: a stop
+// that no route reaches fails the plan even among stops that can be reached,
+// and a plan cancelled while its legs are being routed is cut short.
+void testLegResults(const StreetMap& sm, const StreetMap& tiled)
+{
+    GeoCoord depot, cutOff;
+    vector<DeliveryRequest> joined;
+    pickStops(sm, depot, joined, cutOff);
+
+    //a tiled map has no components, so it takes routing the leg to find the
+    //cut-off stop can't be reached
+    DeliveryPlanner tiledPlanner(&tiled);
+    vector<DeliveryRequest> deliveries = joined;
+    deliveries.insert(deliveries.begin() + 3, DeliveryRequest("cut off", cutOff));
+    vector<DeliveryCommand> commands;
+    double miles = 0;
+    check(tiledPlanner.generateDeliveryPlan(depot, deliveries, commands, miles) == NO_ROUTE,
+        "one stop no route reaches among reachable ones is NO_ROUTE");
+    CancellationToken generous(chrono::steady_clock::now() + chrono::seconds(60));
+    AsyncPlanResult res = tiledPlanner.generateDeliveryPlanAsync(depot, deliveries, generous).get();
+    check(res.result == NO_ROUTE && !generous.isCancelled(),
+        "one stop no route reaches is NO_ROUTE within its deadline, not cut short");
+
+    //many stops, routed one after another on a single thread, and cancelled
+    //once the first of them has been routed; a plan that finished first is
+    //tried again
+    vector<GeoCoord> coords;
+    sm.getAllCoords(coords);
+    deliveries.clear();
+    for (size_t k = 0; k < coords.size(); k += coords.size() / 60 + 1)
+    {
+        size_t component, depotComponent;
+        sm.getComponent(coords[k], component);
+        sm.getComponent(depot, depotComponent);
+        if (component == depotComponent)
+            deliveries.push_back(DeliveryRequest("item " + to_string(deliveries.size() + 1), coords[k]));
+    }
+    ThreadPool pool(1);
+    bool cutShort = false;
+    bool consistent = true;
+    for (int tries = 0; tries < 20 && !cutShort && consistent; tries++)
+    {
+        DeliveryPlanner dp(&tiled, &pool);
+        PlanStats stats;
+        dp.setStats(&stats);
+        CancellationToken cancel;
+        future<AsyncPlanResult> pending = dp.generateDeliveryPlanAsync(depot, deliveries, cancel);
+        for (int waits = 0; waits < 10000 && stats.legMicros.count() == 0 && GOOBEREATS_STATS_ENABLED; waits++)
+            this_thread::sleep_for(chrono::microseconds(100));
+        cancel.cancel();
+        res = pending.get();
+        consistent = (res.result == DELIVERY_SUCCESS && res.plan.stops.size() + res.unserved.size() ==
+            deliveries.size() && res.plan.legCommands.size() == res.plan.stops.size() + (res.complete ? 1 : 0));
+        cutShort = consistent && !res.complete && !res.plan.stops.empty();
+    }
+    check(consistent && cutShort, "a plan cancelled while routing its legs keeps the legs it routed, and doesn't fail");
+}
+
+// Every leg of plan drives between its stops as the router would, and the
+// plan's totals and commands are made of its legs.
+bool planIsSound(const StreetMap& sm, const DeliveryPlan& plan, const vector<DeliveryCommand>& commands,
+    double totalDistance)
+{
+    if (plan.legCommands.size() != plan.stops.size() + 1 || plan.legDistances.size() != plan.legCommands.size())
+        return false;
+    PointToPointRouter router(&sm);
+    double sum = 0;
+    size_t numCommands = 0;
+    for (size_t k = 0; k < plan.legCommands.size(); k++)
+    {
+        const GeoCoord& from = (k == 0 ? plan.depot : plan.stops[k - 1].location);
+        const GeoCoord& to = (k == plan.stops.size() ? plan.depot : plan.stops[k].location);
+        list<StreetSegment> route;
+        double miles = 0;
+        if (router.generatePointToPointRoute(from, to, route, miles) != DELIVERY_SUCCESS ||
+            abs(miles - plan.legDistances[k]) > 1e-9)
+            return false;
+        const vector<DeliveryCommand>& leg = plan.legCommands[k];
+        bool delivers = !leg.empty() && leg.back().description().compare(0, 8, "DELIVER ") == 0;
+        if (delivers != (k < plan.stops.size()) ||
+            (delivers && leg.back().description() != "DELIVER " + plan.stops[k].item))
+            return false;
+        sum += plan.legDistances[k];
+        numCommands += leg.size();
+    }
+    return abs(sum - plan.totalDistance) < 1e-9 && abs(totalDistance - plan.totalDistance) < 1e-9 &&
+        commands.size() == numCommands;
+}
+
+// A map point that the cheapest insertion puts at position pos of plan.
+bool findLateStop(const StreetMap& sm, const DeliveryPlan& plan, const GeoCoord& depot, size_t pos,
+    GeoCoord& late)
+{
+    vector<GeoCoord> coords;
+    sm.getAllCoords(coords);
+    for (size_t i = 0; i < coords.size(); i += 7)
+    {
+        size_t component, depotComponent;
+        sm.getComponent(coords[i], component);
+        sm.getComponent(depot, depotComponent);
+        if (component != depotComponent)
+            continue;
+        size_t bestPos = 0;
+        double bestCost = 0;
+        for (size_t p = 0; p <= plan.stops.size(); p++)
+        {
+            const GeoCoord& prev = (p == 0 ? plan.depot : plan.stops[p - 1].location);
+            const GeoCoord& next = (p == plan.stops.size() ? plan.depot : plan.stops[p].location);
+            double cost = distanceEarthMiles(prev, coords[i]) + distanceEarthMiles(coords[i], next)
+                - distanceEarthMiles(prev, next);
+            if (p == 0 || cost < bestCost)
+            {
+                bestCost = cost;
+                bestPos = p;
+            }
+        }
+        if (bestPos == pos)
+        {
+            late = coords[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+void testInsertion(const StreetMap& sm)
+{
+    GeoCoord depot, cutOff;
+    vector<DeliveryRequest> joined;
+    pickStops(sm, depot, joined, cutOff);
+    DeliveryPlanner dp(&sm);
+    vector<DeliveryRequest> first(joined.begin(), joined.begin() + 4);
+    DeliveryPlan planned;
+    if (dp.generateDeliveryPlan(depot, first, planned) != DELIVERY_SUCCESS)
+    {
+        check(false, "plan the stops to insert into");
+        return;
+    }
+
+    //at the front, in the middle and at the end
+    const char* where[] = { "at the front", "in the middle", "at the end" };
+    size_t positions[] = { 0, 2, first.size() };
+    for (int w = 0; w < 3; w++)
+    {
+        DeliveryPlan plan = planned;
+        GeoCoord late;
+        if (!findLateStop(sm, plan, depot, positions[w], late))
+        {
+            check(false, string("find a stop that goes ") + where[w]);
+            continue;
+        }
+        vector<DeliveryCommand> commands;
+        double miles;
+        DeliveryResult res = dp.insertDeliveries(plan, vector<DeliveryRequest>(1, DeliveryRequest("late", late)),
+            commands, miles);
+        check(res == DELIVERY_SUCCESS && plan.stops.size() == first.size() + 1 &&
+            plan.stops[positions[w]].item == "late" && planIsSound(sm, plan, commands, miles),
+            string("a late delivery is inserted ") + where[w]);
+    }
+
+    //an empty plan, with and without late deliveries
+    vector<DeliveryCommand> commands(1);
+    double miles = 1;
+    DeliveryPlan empty;
+    check(dp.insertDeliveries(empty, vector<DeliveryRequest>(), commands, miles) == DELIVERY_SUCCESS &&
+        empty.legCommands.empty() && commands.empty() && miles == 0,
+        "nothing inserted into a default plan leaves it without legs");
+    empty.depot = depot;
+    check(dp.insertDeliveries(empty, first, commands, miles) == DELIVERY_SUCCESS &&
+        empty.stops.size() == first.size() && planIsSound(sm, empty, commands, miles),
+        "late deliveries inserted into an empty plan are all routed");
+
+    //a plan cut short has no way back to the depot
+    DeliveryPlan partial = planned;
+    partial.legCommands.pop_back();
+    partial.legDistances.pop_back();
+    vector<DeliveryRequest> rest(joined.begin() + 4, joined.end());
+    check(dp.insertDeliveries(partial, rest, commands, miles) == DELIVERY_SUCCESS &&
+        partial.stops.size() == joined.size() && planIsSound(sm, partial, commands, miles),
+        "late deliveries inserted into a plan cut short complete it");
+    partial = planned;
+    partial.legCommands.pop_back();
+    partial.legDistances.pop_back();
+    check(dp.insertDeliveries(partial, vector<DeliveryRequest>(), commands, miles) == DELIVERY_SUCCESS &&
+        planIsSound(sm, partial, commands, miles), "a plan cut short gets its way back with nothing inserted");
+
+    //legs that don't match the stops are routed afresh
+    DeliveryPlan malformed = planned;
+    malformed.legCommands.resize(1);
+    check(dp.insertDeliveries(malformed, rest, commands, miles) == DELIVERY_SUCCESS &&
+        planIsSound(sm, malformed, commands, miles), "a plan whose legs don't match its stops is routed afresh");
+}
+
+size_t countDeliveries(const vector<DeliveryCommand>& commands)
+{
+    size_t n = 0;
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        if (commands[k].description().compare(0, 8, "DELIVER ") == 0)
+            n++;
+    }
+    return n;
+}
+
+void testDrivers(const StreetMap& sm)
+{
+    GeoCoord depot, cutOff;
+    vector<DeliveryRequest> joined;
+    pickStops(sm, depot, joined, cutOff);
+    //the drivers' plans and their legs all share two threads
+    ThreadPool pool(2);
+    DeliveryPlanner dp(&sm, &pool);
+    vector<vector<DeliveryCommand>> commands;
+    vector<double> miles;
+
+    //as even a split as capacity allows, and no more stops than it allows
+    DeliveryResult res = dp.generateDeliveryPlans(depot, joined, 3, commands, miles, 2);
+    bool even = (res == DELIVERY_SUCCESS && commands.size() == 3 && miles.size() == 3);
+    for (size_t d = 0; even && d < commands.size(); d++)
+        even = (countDeliveries(commands[d]) == 2 && miles[d] > 0);
+    check(even, "stops filling the drivers' capacity are split evenly");
+    check(dp.generateDeliveryPlans(depot, joined, 2, commands, miles, 2) == NO_ROUTE,
+        "more stops than the drivers can carry is NO_ROUTE");
+    res = dp.generateDeliveryPlans(depot, joined, 4, commands, miles, 2);
+    bool capped = (res == DELIVERY_SUCCESS && commands.size() == 4);
+    size_t served = 0;
+    for (size_t d = 0; capped && d < commands.size(); d++)
+    {
+        capped = (countDeliveries(commands[d]) <= 2);
+        served += countDeliveries(commands[d]);
+    }
+    check(capped && served == joined.size(), "spare capacity leaves every driver within it");
+
+    //more drivers than stops, and no stops at all
+    vector<DeliveryRequest> few(joined.begin(), joined.begin() + 2);
+    res = dp.generateDeliveryPlans(depot, few, 5, commands, miles);
+    size_t idle = 0;
+    served = 0;
+    for (size_t d = 0; d < commands.size(); d++)
+    {
+        served += countDeliveries(commands[d]);
+        if (commands[d].empty() && miles[d] == 0)
+            idle++;
+    }
+    check(res == DELIVERY_SUCCESS && commands.size() == 5 && served == 2 && idle == 3,
+        "drivers beyond the number of stops get empty plans");
+    res = dp.generateDeliveryPlans(depot, vector<DeliveryRequest>(), 3, commands, miles, 1);
+    check(res == DELIVERY_SUCCESS && commands.size() == 3 && miles.size() == 3 && commands[0].empty() &&
+        commands[1].empty() && commands[2].empty(), "no stops gives every driver an empty plan");
+    check(dp.generateDeliveryPlans(depot, joined, 0, commands, miles) == NO_ROUTE, "no drivers is NO_ROUTE");
+
+    //more items for any one stop's spot all go to the driver with that stop,
+    //wherever the sweep reaches it
+    bool together = true;
+    for (size_t j = 0; together && j < joined.size(); j++)
+    {
+        vector<DeliveryRequest> shared = joined;
+        shared.push_back(DeliveryRequest("again", joined[j].location));
+        shared.push_back(DeliveryRequest("once more", joined[j].location));
+        for (int numDrivers = 2; together && numDrivers <= 3; numDrivers++)
+        {
+            together = (dp.generateDeliveryPlans(depot, shared, numDrivers, commands, miles) == DELIVERY_SUCCESS);
+            for (size_t d = 0; together && d < commands.size(); d++)
+            {
+                size_t atSpot = 0;
+                for (size_t k = 0; k < commands[d].size(); k++)
+                {
+                    string description = commands[d][k].description();
+                    if (description == "DELIVER " + joined[j].item || description == "DELIVER again" ||
+                        description == "DELIVER once more")
+                        atSpot++;
+                }
+                together = (atSpot == 0 || atSpot == 3);
+            }
+        }
+    }
+    check(together, "items for the same spot go to one driver");
+}
+
+// Collects the sink overload's steps as their descriptions.
+class DescriptionSink : public DeliveryCommandSink
+{
+public:
+    vector<string> descriptions;
+
+    void accept(const DeliveryStep& step)
+    {
+        string buffer;
+        appendDescription(step, buffer);
+        descriptions.push_back(buffer);
+    }
+};
+
+// The sink overload pushes the steps the vector overload returns as commands,
+// described the same way, and drives as far.
+void testSink(const StreetMap& sm)
+{
+    GeoCoord depot, cutOff;
+    vector<DeliveryRequest> joined;
+    pickStops(sm, depot, joined, cutOff);
+    DeliveryPlanner dp(&sm);
+    vector<DeliveryCommand> commands;
+    double totalMiles = 0;
+    DescriptionSink sink;
+    double sinkMiles = 0;
+    DeliveryResult res = dp.generateDeliveryPlan(depot, joined, commands, totalMiles);
+    DeliveryResult sinkRes = dp.generateDeliveryPlan(depot, joined, sink, sinkMiles);
+    check(res == DELIVERY_SUCCESS && sinkRes == DELIVERY_SUCCESS && !commands.empty(),
+        "the same stops plan through both overloads");
+    bool same = (sink.descriptions.size() == commands.size());
+    for (size_t k = 0; same && k < commands.size(); k++)
+        same = (sink.descriptions[k] == commands[k].description());
+    check(same, "each step the sink gets is described as the vector overload's command");
+    check(abs(sinkMiles - totalMiles) < 1e-9, "both overloads drive as far");
+}
+
+// Several items for one spot, and one for the depot itself, are delivered back
+// to back with no driving in between, and each spot is routed to only once.
+void testCoLocated(const StreetMap& sm)
+{
+    GeoCoord depot, cutOff;
+    vector<DeliveryRequest> joined;
+    pickStops(sm, depot, joined, cutOff);
+    const GeoCoord& stop = joined[0].location;
+    vector<DeliveryRequest> deliveries;
+    deliveries.push_back(DeliveryRequest("first at the stop", stop));
+    deliveries.push_back(DeliveryRequest("at the depot", depot));
+    deliveries.push_back(DeliveryRequest("second at the stop", stop));
+    deliveries.push_back(DeliveryRequest("third at the stop", stop));
+
+    DeliveryPlanner dp(&sm);
+    PlanStats stats;
+    dp.setStats(&stats);
+    vector<DeliveryCommand> commands;
+    double totalMiles = 0;
+    DeliveryResult res = dp.generateDeliveryPlan(depot, deliveries, commands, totalMiles);
+    check(res == DELIVERY_SUCCESS && countDeliveries(commands) == deliveries.size() && totalMiles > 0,
+        "items sharing a spot, and one at the depot, are all delivered");
+
+    //the stop's items in one run, and the depot's item before leaving or
+    //after coming back
+    size_t firstAtStop = commands.size();
+    size_t lastAtStop = 0;
+    size_t atDepot = commands.size();
+    for (size_t k = 0; k < commands.size(); k++)
+    {
+        string description = commands[k].description();
+        if (description == "DELIVER at the depot")
+            atDepot = k;
+        else if (description.compare(0, 8, "DELIVER ") == 0)
+        {
+            firstAtStop = min(firstAtStop, k);
+            lastAtStop = k;
+        }
+    }
+    check(firstAtStop < commands.size() && lastAtStop - firstAtStop == 2,
+        "the items at one spot are delivered one straight after another");
+    check(atDepot == 0 || atDepot == commands.size() - 1,
+        "the item at the depot is delivered without driving anywhere");
+
+    //there and back: one search for each spot that isn't where the driver
+    //already is
+    check(stats.queries == 2 || !GOOBEREATS_STATS_ENABLED, "each distinct stop is routed to once");
+}
+
+
+// The plan, written by BinaryRouteWriter and read back, has the same commands
+// as the vector overload gives, and the points along each street add up to
+// its distance.
+void testBinaryRoute(const StreetMap& sm)
+{
+    GeoCoord depot, cutOff;
+    vector<DeliveryRequest> joined;
+    pickStops(sm, depot, joined, cutOff);
+    DeliveryPlanner dp(&sm);
+    vector<DeliveryCommand> commands;
+    double totalMiles = 0;
+    string data;
+    BinaryRouteWriter writer(data);
+    double streamedMiles = 0;
+    if (dp.generateDeliveryPlan(depot, joined, commands, totalMiles) != DELIVERY_SUCCESS ||
+        dp.generateDeliveryPlan(depot, joined, writer, streamedMiles) != DELIVERY_SUCCESS)
+    {
+        check(false, "plan the stops to write");
+        return;
+    }
+    writer.finish(DELIVERY_SUCCESS, streamedMiles);
+
+    vector<BinaryRouteRecord> records;
+    bool read = readBinaryRoute(data, records);
+    check(read && records.size() == commands.size() + 1 && records.back().type == BinaryRouteRecord::END,
+        "a written plan reads back with a record per command and an END");
+    if (!read || records.size() != commands.size() + 1)
+        return;
+
+    //the same kinds of command on the same streets; distances are only kept
+    //to 1/100000 mile, so a PROCEED is compared up to its distance
+    bool same = true;
+    double proceedMiles = 0;
+    size_t numProceeds = 0;
+    for (size_t k = 0; same && k < commands.size(); k++)
+    {
+        const BinaryRouteRecord& rec = records[k];
+        DeliveryCommand decoded;
+        string expected = commands[k].description();
+        string actual;
+        switch (rec.type)
+        {
+        case BinaryRouteRecord::PROCEED:
+            decoded.initAsProceedCommand(rec.direction, rec.streetName, rec.distance);
+            expected = expected.substr(0, expected.rfind(" for "));
+            actual = decoded.description();
+            actual = actual.substr(0, actual.rfind(" for "));
+            proceedMiles += rec.distance;
+            numProceeds++;
+            break;
+        case BinaryRouteRecord::TURN:
+            decoded.initAsTurnCommand(rec.direction, rec.streetName);
+            actual = decoded.description();
+            break;
+        case BinaryRouteRecord::DELIVER:
+            decoded.initAsDeliverCommand(rec.item);
+            actual = decoded.description();
+            break;
+        case BinaryRouteRecord::END:
+            same = false;
+            break;
+        }
+        same = same && actual == expected && decoded.streetName() == commands[k].streetName();
+    }
+    check(same, "each record decodes to the command the vector overload gives");
+    check(abs(proceedMiles - totalMiles) <= 1e-5 * (numProceeds + 1),
+        "the PROCEED distances add up to the plan's total");
+    check(records.back().result == DELIVERY_SUCCESS && abs(records.back().distance - totalMiles) <= 1e-5,
+        "the END record carries the result and the total");
+
+    //every street starts where the last one ended, the first one at the depot,
+    //and its points are as far apart as it says
+    bool joinedUp = true;
+    pair<double, double> last(depot.latitude, depot.longitude);
+    for (size_t k = 0; joinedUp && k < commands.size(); k++)
+    {
+        const BinaryRouteRecord& rec = records[k];
+        if (rec.type != BinaryRouteRecord::PROCEED)
+            continue;
+        joinedUp = rec.points.size() >= 2 && abs(rec.points[0].first - last.first) <= 1e-7 &&
+            abs(rec.points[0].second - last.second) <= 1e-7;
+        double miles = 0;
+        GeoCoord from, to;
+        for (size_t p = 1; joinedUp && p < rec.points.size(); p++)
+        {
+            from.latitude = rec.points[p - 1].first;
+            from.longitude = rec.points[p - 1].second;
+            to.latitude = rec.points[p].first;
+            to.longitude = rec.points[p].second;
+            miles += distanceEarthMiles(from, to);
+        }
+        joinedUp = joinedUp && abs(miles - rec.distance) <= 1e-3 * (rec.distance + 1e-2);
+        last = rec.points.back();
+    }
+    check(joinedUp && abs(last.first - depot.latitude) <= 1e-7 && abs(last.second - depot.longitude) <= 1e-7,
+        "the streets' points run on from the depot and back to it, as long as their distances");
+
+    //a stream cut short doesn't read
+    check(!readBinaryRoute(data.substr(0, data.size() - 1), records), "a truncated stream doesn't read");
+}
+
+void testTiles(const StreetMap& sm, const string& mapFile, const string& dir)
+{
+    string tileIndex = dir + "/planner_test_lost_tiles.txt";
+    StreetMap tiled;
+    if (!splitMapIntoTiles(mapFile, tileIndex, 0.02) || !tiled.load(tileIndex))
+    {
+        check(false, "split the map into tiles");
+        return;
+    }
+
+    //threads loading and evicting tiles all the while still see the whole map
+    tiled.setTileMemoryLimit(1);
+    vector<GeoCoord> coords;
+    sm.getAllCoords(coords);
+    const int numThreads = 4;
+    vector<size_t> mismatches(numThreads, 0);
+    vector<thread> threads;
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads.push_back(thread([&, t]()
+        {
+            vector<StreetSegment> whole, fromTiles;
+            for (size_t k = t; k < coords.size(); k += numThreads)
+            {
+                sm.getSegmentsThatStartWith(coords[k], whole);
+                if (!tiled.getSegmentsThatStartWith(coords[k], fromTiles) || fromTiles.size() != whole.size())
+                    mismatches[t]++;
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    size_t numMismatches = 0;
+    for (int t = 0; t < numThreads; t++)
+        numMismatches += mismatches[t];
+    TileCacheStats stats = tiled.getTileCacheStats();
+    check(numMismatches == 0 && stats.evictions > 0 && stats.failedLoads == 0,
+        "threads sharing a tiled map under its memory limit find every point's segments");
+
+    //a tile whose file goes missing fails every query, until it's back
+    GeoCoord gc = coords[coords.size() / 2];
+    string tileFile;
+    ifstream index(tileIndex);
+    string line;
+    getline(index, line);
+    while (tileFile.empty() && getline(index, line))
+    {
+        long long row, col;
+        string name;
+        istringstream iss(line);
+        if (iss >> row >> col >> name && row == static_cast<long long>(floor(gc.latitude / 0.02)) &&
+            col == static_cast<long long>(floor(gc.longitude / 0.02)))
+            tileFile = dir + "/" + name;
+    }
+    tiled.setTileMemoryLimit(0);
+    StreetMap lost;
+    vector<StreetSegment> segs;
+    if (tileFile.empty() || !lost.load(tileIndex) || rename(tileFile.c_str(), (tileFile + ".lost").c_str()) != 0)
+    {
+        check(false, "move a tile file away");
+        return;
+    }
+    bool missing = !lost.getSegmentsThatStartWith(gc, segs) && !lost.getSegmentsThatStartWith(gc, segs) &&
+        lost.getTileCacheStats().failedLoads == 2;
+    rename((tileFile + ".lost").c_str(), tileFile.c_str());
+    check(missing && lost.getSegmentsThatStartWith(gc, segs) && lost.getTileCacheStats().failedLoads == 2,
+        "a tile that won't open is tried again by each query, not kept as empty");
+}
+
+int main(int argc, char* argv[])
+{
+    string mapFile = "mapdata.txt";
+    string dir = ".";
+    for (int k = 1; k < argc; k++)
+    {
+        string arg = argv[k];
+        if (arg == "-dir" && k + 1 < argc)
+            dir = argv[++k];
+        else if (arg[0] != '-')
+            mapFile = arg;
+        else
+        {
+            cout << "Usage: " << argv[0] << " [mapdata.txt] [-dir directory]" << endl;
+            return 1;
+        }
+    }
+
+    StreetMap sm;
+    StreetMap tiled;
+    string tileIndex = dir + "/planner_test_tiles.txt";
+    if (!sm.load(mapFile) || !splitMapIntoTiles(mapFile, tileIndex, 0.05) || !tiled.load(tileIndex))
+    {
+        cout << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+
+    testCancellation(sm, tiled);
+    testLegResults(sm, tiled);
+    testInsertion(sm);
+    testDrivers(sm);
+    testSink(sm);
+    testCoLocated(sm);
+    testBinaryRoute(sm);
+    testTiles(sm, mapFile, dir);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+// Router validation: routes random pairs of map points with
+// PointToPointRouter, both over its contracted intersection graph and point
+// by point, and with a plain Dijkstra oracle, reporting mismatches, the
+// largest relative error in distance and each router's speedup.
+//
+// Usage: router_oracle_test [mapdata.txt] [-pairs N] [-seed S] [-tolerance T]
+//                           [-tiles index.txt [-degrees D] [-tilecap bytes]]
+//
+// With -tiles, the map is first split into tiles and the router runs over
+// the tiled map, loading tiles as it goes and keeping at most -tilecap bytes
+// of them, while the oracle runs over the whole map.
+//
+// Fails if the router disagrees with the oracle on any pair or returns a
+// route that isn't a connected path through the map.
+
+#include "provided.h"
+#include "RouterOracle.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    string mapFile = "mapdata.txt";
+    size_t numPairs = 2000;
+    unsigned int seed = 37;
+    double tolerance = 1e-9;
+    string tileIndex;
+    double tileDegrees = 0.05;
+    size_t tileCap = 0;
+    for (int k = 1; k < argc; k++)
+    {
+        string arg = argv[k];
+        if (arg == "-pairs" && k + 1 < argc)
+            numPairs = stoul(argv[++k]);
+        else if (arg == "-seed" && k + 1 < argc)
+            seed = stoul(argv[++k]);
+        else if (arg == "-tolerance" && k + 1 < argc)
+            tolerance = stod(argv[++k]);
+        else if (arg == "-tiles" && k + 1 < argc)
+            tileIndex = argv[++k];
+        else if (arg == "-degrees" && k + 1 < argc)
+            tileDegrees = stod(argv[++k]);
+        else if (arg == "-tilecap" && k + 1 < argc)
+            tileCap = stoul(argv[++k]);
+        else if (arg[0] != '-')
+            mapFile = arg;
+        else
+        {
+            cout << "Usage: " << argv[0] << " [mapdata.txt] [-pairs N] [-seed S] [-tolerance T]"
+                << " [-tiles index.txt [-degrees D] [-tilecap bytes]]" << endl;
+            return 1;
+        }
+    }
+
+    StreetMap sm;
+    if (!sm.load(mapFile))
+    {
+        cout << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    vector<GeoCoord> nodes;
+    sm.getAllCoords(nodes);
+    if (nodes.empty())
+    {
+        cout << mapFile << " has no streets" << endl;
+        return 1;
+    }
+
+    mt19937 rng(seed);
+    uniform_int_distribution<size_t> pickNode(0, nodes.size() - 1);
+    vector<pair<GeoCoord, GeoCoord>> pairs;
+    for (size_t k = 0; k < numPairs; k++)
+        pairs.push_back(make_pair(nodes[pickNode(rng)], nodes[pickNode(rng)]));
+
+    StreetMap tiled;
+    if (!tileIndex.empty())
+    {
+        if (!splitMapIntoTiles(mapFile, tileIndex, tileDegrees) || !tiled.load(tileIndex))
+        {
+            cout << "Unable to split " << mapFile << " into " << tileIndex << endl;
+            return 1;
+        }
+        tiled.setTileMemoryLimit(tileCap);
+    }
+    cout << mapFile << ": " << nodes.size() << " points, " << pairs.size() << " pairs" << endl;
+    bool passed = true;
+    const char* names[] = { "PointToPointRouter", "PointToPointRouter point by point" };
+    for (int contract = 1; contract >= 0; contract--)
+    {
+        PointToPointRouter router(tileIndex.empty() ? &sm : &tiled);
+        router.setChainContraction(contract == 1);
+        RouteFunction route = [&router](const GeoCoord& start, const GeoCoord& end,
+            list<StreetSegment>& segs, double& dist)
+        {
+            return router.generatePointToPointRoute(start, end, segs, dist);
+        };
+        OracleReport report = validateRouter(sm, route, pairs, tolerance, cout);
+        cout << names[1 - contract] << ": " << report.routed << " routable, " << report.mismatches
+            << " mismatches, " << report.invalidRoutes << " invalid routes, max relative error "
+            << report.maxRelativeError << ", " << report.routerSeconds << " s against the oracle's "
+            << report.oracleSeconds << " s (" << report.speedup() << "x)" << endl;
+        passed = passed && report.mismatches == 0 && report.invalidRoutes == 0;
+    }
+    if (!tileIndex.empty())
+    {
+        TileCacheStats tcs = tiled.getTileCacheStats();
+        cout << "tiles: " << tcs.tiles << ", " << tcs.loadedTiles << " loaded holding about "
+            << tcs.loadedBytes << " bytes, " << tcs.loads << " loads, " << tcs.evictions << " evictions" << endl;
+    }
+    return passed ? 0 : 1;
+}
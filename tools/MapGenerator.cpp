@@ -0,0 +1,213 @@
+#include "MapGenerator.h"
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <algorithm>
+using namespace std;
+
+string coordText(double degrees)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.7f", degrees);
+    return buf;
+}
+
+GeoCoord makeCoord(double lat, double lon)
+{
+    return GeoCoord(coordText(lat), coordText(lon));
+}
+
+// Write one street: every block from ends[k] to ends[k + 1] that is kept,
+// with its mid-block shape points wiggled a little off the straight line.
+void writeStreet(ostream& out, const string& name, const vector<GeoCoord>& ends, const vector<bool>& kept,
+    int shapePoints, double wiggle, mt19937& rng, size_t& numSegments)
+{
+    size_t numKept = count(kept.begin(), kept.end(), true);
+    if (numKept == 0)
+        return;
+    out << name << '\n' << numKept * (shapePoints + 1) << '\n';
+    uniform_real_distribution<double> offset(-wiggle, wiggle);
+    for (size_t b = 0; b < kept.size(); b++)
+    {
+        if (!kept[b])
+            continue;
+        const GeoCoord& from = ends[b];
+        const GeoCoord& to = ends[b + 1];
+        string prev = from.latitudeText + " " + from.longitudeText;
+        for (int k = 1; k <= shapePoints + 1; k++)
+        {
+            string next;
+            if (k == shapePoints + 1)
+                next = to.latitudeText + " " + to.longitudeText;
+            else
+            {
+                double t = static_cast<double>(k) / (shapePoints + 1);
+                double lat = from.latitude + t * (to.latitude - from.latitude) + offset(rng);
+                double lon = from.longitude + t * (to.longitude - from.longitude) + offset(rng);
+                next = coordText(lat) + " " + coordText(lon);
+            }
+            out << prev << ' ' << next << '\n';
+            prev = next;
+        }
+        numSegments += shapePoints + 1;
+    }
+}
+
+void generateMap(const MapGenOptions& opts, ostream& out, GeneratedMap& map)
+{
+    mt19937 rng(opts.seed);
+    int n = opts.gridSize;
+    double block = opts.blockDegrees;
+    uniform_real_distribution<double> jitter(-0.2 * block, 0.2 * block);
+    uniform_real_distribution<double> coin(0, 1);
+
+    //perturbed grid of intersections
+    map.gridSize = n;
+    map.numSegments = 0;
+    map.numStreets = 0;
+    map.intersections.clear();
+    for (int r = 0; r <= n; r++)
+    {
+        for (int c = 0; c <= n; c++)
+        {
+            map.intersections.push_back(makeCoord(opts.originLatitude + r * block + jitter(rng),
+                opts.originLongitude + c * block + jitter(rng)));
+        }
+    }
+
+    //turn some side-street intersections into dead ends by leaving out all
+    //but one of their blocks; arterial blocks are never left out
+    bool noArterials = (opts.arterialEvery <= 0);
+    vector<vector<bool>> rowKept(n + 1, vector<bool>(n, true));
+    vector<vector<bool>> colKept(n + 1, vector<bool>(n, true));
+    for (int r = 0; r <= n; r++)
+    {
+        for (int c = 0; c <= n; c++)
+        {
+            bool onArterial = (!noArterials && (r % opts.arterialEvery == 0 || c % opts.arterialEvery == 0));
+            if (onArterial || coin(rng) >= opts.deadEndFraction)
+                continue;
+            //the blocks west, east, south and north of it that exist
+            vector<vector<bool>::reference> blocks;
+            if (c > 0)
+                blocks.push_back(rowKept[r][c - 1]);
+            if (c < n)
+                blocks.push_back(rowKept[r][c]);
+            if (r > 0)
+                blocks.push_back(colKept[c][r - 1]);
+            if (r < n)
+                blocks.push_back(colKept[c][r]);
+            uniform_int_distribution<size_t> pick(0, blocks.size() - 1);
+            size_t keep = pick(rng);
+            for (size_t k = 0; k < blocks.size(); k++)
+                blocks[k] = (k == keep);
+        }
+    }
+
+    //then put back just enough of the left out blocks, each joining two
+    //pieces not yet joined, that no intersection is cut off from the rest
+    vector<int> pieceOf((n + 1) * (n + 1));
+    for (size_t k = 0; k < pieceOf.size(); k++)
+        pieceOf[k] = k;
+    auto findPiece = [&pieceOf](int k)
+    {
+        while (pieceOf[k] != k)
+            k = pieceOf[k] = pieceOf[pieceOf[k]];
+        return k;
+    };
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int line = 0; line <= n; line++)
+        {
+            for (int b = 0; b < n; b++)
+            {
+                int rowA = findPiece(line * (n + 1) + b), rowB = findPiece(line * (n + 1) + b + 1);
+                if (rowKept[line][b] || (pass == 1 && rowA != rowB))
+                {
+                    rowKept[line][b] = true;
+                    pieceOf[rowA] = rowB;
+                }
+                int colA = findPiece(b * (n + 1) + line), colB = findPiece((b + 1) * (n + 1) + line);
+                if (colKept[line][b] || (pass == 1 && colA != colB))
+                {
+                    colKept[line][b] = true;
+                    pieceOf[colA] = colB;
+                }
+            }
+        }
+    }
+
+    double wiggle = 0.05 * block;
+    for (int line = 0; line <= n; line++)
+    {
+        bool arterial = (!noArterials && line % opts.arterialEvery == 0);
+        vector<GeoCoord> ends;
+        for (int k = 0; k <= n; k++)
+            ends.push_back(map.at(line, k));
+        writeStreet(out, (arterial ? "Arterial Boulevard " : "Row Street ") + to_string(line), ends,
+            rowKept[line], opts.shapePoints, wiggle, rng, map.numSegments);
+        ends.clear();
+        for (int k = 0; k <= n; k++)
+            ends.push_back(map.at(k, line));
+        writeStreet(out, (arterial ? "Arterial Avenue " : "Column Street ") + to_string(line), ends,
+            colKept[line], opts.shapePoints, wiggle, rng, map.numSegments);
+        map.numStreets += 2;
+    }
+
+    //islands: little 3 by 3 block grids east of the city that no street reaches
+    for (int i = 0; i < opts.numIslands; i++)
+    {
+        double baseLon = opts.originLongitude + (n + 3 + 5 * i) * block;
+        vector<bool> allKept(3, true);
+        for (int line = 0; line <= 3; line++)
+        {
+            vector<GeoCoord> rowEnds, colEnds;
+            for (int k = 0; k <= 3; k++)
+            {
+                rowEnds.push_back(makeCoord(opts.originLatitude + line * block, baseLon + k * block));
+                colEnds.push_back(makeCoord(opts.originLatitude + k * block, baseLon + line * block));
+            }
+            writeStreet(out, "Island " + to_string(i) + " Row " + to_string(line), rowEnds, allKept,
+                opts.shapePoints, wiggle, rng, map.numSegments);
+            writeStreet(out, "Island " + to_string(i) + " Column " + to_string(line), colEnds, allKept,
+                opts.shapePoints, wiggle, rng, map.numSegments);
+            map.numStreets += 2;
+        }
+    }
+}
+
+void generateDeliveries(const GeneratedMap& map, const DeliveryGenOptions& opts, ostream& out,
+    GeoCoord& depot, vector<DeliveryRequest>& deliveries)
+{
+    mt19937 rng(opts.seed);
+    int n = map.gridSize;
+    uniform_int_distribution<int> anywhere(0, n);
+    uniform_int_distribution<int> nearby(-opts.clusterRadius, opts.clusterRadius);
+
+    vector<pair<int, int>> centers;
+    for (int k = 0; k < opts.numClusters; k++)
+        centers.push_back(make_pair(anywhere(rng), anywhere(rng)));
+
+    depot = map.at(n / 2, n / 2);
+    deliveries.clear();
+    out << depot.latitudeText << ' ' << depot.longitudeText << '\n';
+    for (int k = 0; k < opts.numStops; k++)
+    {
+        int row, col;
+        if (centers.empty())
+        {
+            row = anywhere(rng);
+            col = anywhere(rng);
+        }
+        else
+        {
+            const pair<int, int>& center = centers[k % centers.size()];
+            row = min(max(center.first + nearby(rng), 0), n);
+            col = min(max(center.second + nearby(rng), 0), n);
+        }
+        const GeoCoord& loc = map.at(row, col);
+        deliveries.push_back(DeliveryRequest("Package " + to_string(k + 1), loc));
+        out << loc.latitudeText << ' ' << loc.longitudeText << ":Package " << k + 1 << '\n';
+    }
+}
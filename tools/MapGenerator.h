@@ -0,0 +1,54 @@
+// MapGenerator.h
+
+#ifndef MAPGENERATOR_H
+#define MAPGENERATOR_H
+
+#include "provided.h"
+#include <iostream>
+#include <vector>
+
+// Synthetic maps and deliveries for scaling tests, written in the same text
+// formats as mapdata.txt and deliveries.txt.
+
+struct MapGenOptions
+{
+    int gridSize = 50;              // blocks along each side of the city
+    int shapePoints = 1;            // mid-block points on every block
+    int arterialEvery = 5;          // every n-th row and column is an arterial
+    double deadEndFraction = 0.05;  // share of side-street intersections made dead ends
+    int numIslands = 2;             // small street grids unreachable from the city
+    double blockDegrees = 0.001;    // roughly 100 m between intersections
+    double originLatitude = 34.0;
+    double originLongitude = -118.5;
+    unsigned int seed = 1;
+};
+
+struct DeliveryGenOptions
+{
+    int numStops = 10;
+    int numClusters = 0;            // 0 spreads the stops over the whole city
+    int clusterRadius = 3;          // in blocks
+    unsigned int seed = 1;
+};
+
+// A generated city: the intersections of its main grid by row and column,
+// so that deliveries can be placed on streets that can reach each other.
+// Blocks are left out to make dead ends, but never on an arterial, and
+// never so that any intersection of the main grid is cut off from the rest.
+struct GeneratedMap
+{
+    int gridSize = 0;
+    std::vector<GeoCoord> intersections;    // row-major, (gridSize + 1)^2 of them
+    size_t numSegments = 0;
+    size_t numStreets = 0;
+
+    const GeoCoord& at(int row, int col) const { return intersections[row * (gridSize + 1) + col]; }
+};
+
+void generateMap(const MapGenOptions& opts, std::ostream& out, GeneratedMap& map);
+
+// Writes a depot near the middle of the city, then one delivery per stop.
+void generateDeliveries(const GeneratedMap& map, const DeliveryGenOptions& opts, std::ostream& out,
+    GeoCoord& depot, std::vector<DeliveryRequest>& deliveries);
+
+#endif // !MAPGENERATOR_H
@@ -0,0 +1,81 @@
+// Synthetic map and delivery generator for scaling tests.
+//
+// Usage: mapgen map.txt [-grid N] [-shape P] [-arterials N] [-deadends F]
+//               [-islands K] [-seed S]
+//               [-deliveries deliveries.txt [-stops N] [-clusters C] [-radius R]]
+
+#include "MapGenerator.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    MapGenOptions mapOpts;
+    DeliveryGenOptions deliveryOpts;
+    string mapFile, deliveriesFile;
+    bool badArgs = false;
+    for (int k = 1; k < argc && !badArgs; k++)
+    {
+        string arg = argv[k];
+        bool hasValue = (k + 1 < argc);
+        if (arg == "-grid" && hasValue)
+            mapOpts.gridSize = stoi(argv[++k]);
+        else if (arg == "-shape" && hasValue)
+            mapOpts.shapePoints = stoi(argv[++k]);
+        else if (arg == "-arterials" && hasValue)
+            mapOpts.arterialEvery = stoi(argv[++k]);
+        else if (arg == "-deadends" && hasValue)
+            mapOpts.deadEndFraction = stod(argv[++k]);
+        else if (arg == "-islands" && hasValue)
+            mapOpts.numIslands = stoi(argv[++k]);
+        else if (arg == "-seed" && hasValue)
+            mapOpts.seed = deliveryOpts.seed = stoul(argv[++k]);
+        else if (arg == "-deliveries" && hasValue)
+            deliveriesFile = argv[++k];
+        else if (arg == "-stops" && hasValue)
+            deliveryOpts.numStops = stoi(argv[++k]);
+        else if (arg == "-clusters" && hasValue)
+            deliveryOpts.numClusters = stoi(argv[++k]);
+        else if (arg == "-radius" && hasValue)
+            deliveryOpts.clusterRadius = stoi(argv[++k]);
+        else if (arg[0] != '-' && mapFile.empty())
+            mapFile = arg;
+        else
+            badArgs = true;
+    }
+    if (badArgs || mapFile.empty() || mapOpts.gridSize < 1)
+    {
+        cout << "Usage: " << argv[0] << " map.txt [-grid N] [-shape P] [-arterials N] [-deadends F]" << endl;
+        cout << "              [-islands K] [-seed S]" << endl;
+        cout << "              [-deliveries deliveries.txt [-stops N] [-clusters C] [-radius R]]" << endl;
+        return 1;
+    }
+
+    ofstream mapOut(mapFile);
+    if (!mapOut)
+    {
+        cout << "Unable to write map data file " << mapFile << endl;
+        return 1;
+    }
+    GeneratedMap map;
+    generateMap(mapOpts, mapOut, map);
+    cout << "Wrote " << map.numStreets << " streets, " << map.numSegments << " segments to " << mapFile << endl;
+
+    if (!deliveriesFile.empty())
+    {
+        ofstream deliveriesOut(deliveriesFile);
+        if (!deliveriesOut)
+        {
+            cout << "Unable to write delivery request file " << deliveriesFile << endl;
+            return 1;
+        }
+        GeoCoord depot;
+        vector<DeliveryRequest> deliveries;
+        generateDeliveries(map, deliveryOpts, deliveriesOut, depot, deliveries);
+        cout << "Wrote " << deliveries.size() << " deliveries to " << deliveriesFile << endl;
+    }
+    return 0;
+}
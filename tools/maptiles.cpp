@@ -0,0 +1,28 @@
+// Splits a map data file into tiles that StreetMap loads on demand.
+//
+// Usage: maptiles mapdata.txt tiles/index.txt [-degrees D]
+//
+// Pass the index file to GooberEats in place of the map data file.
+
+#include "provided.h"
+#include <iostream>
+#include <string>
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    double tileDegrees = 0.05;
+    if (argc == 5 && string(argv[3]) == "-degrees")
+        tileDegrees = stod(argv[4]);
+    else if (argc != 3)
+    {
+        cout << "Usage: " << argv[0] << " mapdata.txt tiles/index.txt [-degrees D]" << endl;
+        return 1;
+    }
+    if (!splitMapIntoTiles(argv[1], argv[2], tileDegrees))
+    {
+        cout << "Unable to split " << argv[1] << " into " << argv[2] << endl;
+        return 1;
+    }
+    return 0;
+}